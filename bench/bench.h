@@ -0,0 +1,81 @@
+/**
+ * Minimal benchmark harness, so benchmarks need nothing but the standard library.
+ *
+ * Each benchmark is timed over enough iterations to take a measurable time,
+ * several times over, and the fastest run reported as one line of JSON.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstdio>
+
+
+/**
+ * Stop the compiler optimizing away a computation whose result is not otherwise used.
+ */
+template<typename T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+
+/**
+ * Times calls of op, which is called with a tick that goes up by one on every call,
+ * through all the runs it takes to time it, so op can use it as a clock that never goes back.
+ */
+class Bench {
+    // Run for at least this long to get a timing.
+    static constexpr double min_run_ns = 20e6;
+    static const int repetitions = 5;
+
+public:
+    template<class Op_t>
+    static double ns_per_op(Op_t op, long &iterations) {
+        long tick = 0;
+        iterations = 1;
+        for (;;) {
+            double ns = time(op, iterations, tick);
+            if (ns >= min_run_ns) {
+                break;
+            }
+            iterations *= ns > 0 ? (min_run_ns / ns < 10 ? 2 : 10) : 10;
+        }
+        double best = time(op, iterations, tick);
+        for (int k = 1; k < repetitions; ++k) {
+            double ns = time(op, iterations, tick);
+            if (ns < best) {
+                best = ns;
+            }
+        }
+        return best / iterations;
+    }
+
+    /**
+     * Time op and print the result on stdout as a line of JSON.
+     * params is the rest of the JSON object, describing the benchmark's parameters.
+     */
+    template<class Op_t>
+    static void run(const char *name, const char *params, Op_t op) {
+        long iterations;
+        double ns = ns_per_op(op, iterations);
+        std::printf("{\"benchmark\": \"%s\", %s, \"iterations\": %ld, \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}\n",
+            name, params, iterations, ns, ns > 0 ? 1e9 / ns : 0.0);
+        std::fflush(stdout);
+    }
+
+private:
+    template<class Op_t>
+    static double time(Op_t &op, long iterations, long &tick) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (long end = tick + iterations; tick < end; ++tick) {
+            op(tick);
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    }
+};
+
+
+#endif // BENCH_H
@@ -0,0 +1,111 @@
+/**
+ * Benchmarks of scanning the matrix and building records,
+ * over a range of matrix sizes and numbers of keys held.
+ *
+ * Prints one line of JSON per benchmark.
+ */
+
+#include <array>
+#include <cstdio>
+#include <vector>
+#include "Arduino.h"
+#include "Keyboard.h"
+#include "bench.h"
+#include "fake_matrix.h"
+#include "keyboard_cortex.h"
+#include "keyboard_matrix.h"
+
+
+// Hold the first held_count switches, counting down the columns.
+void hold(int row_count, int held_count) {
+    FakeMatrixPinTraits::reset();
+    for (int cell = 0; cell < held_count; ++cell) {
+        FakeMatrixPinTraits::matrix().set_closed(cell / row_count, cell % row_count, true);
+    }
+}
+
+
+// Numbers of keys held to try: none, one, a full report, half and all.
+std::vector<int> held_counts(int cell_count) {
+    std::vector<int> counts;
+    const int candidates[] = {0, 1, usb_rollover_max, cell_count / 2, cell_count};
+    for (int count : candidates) {
+        if (count <= cell_count && (counts.empty() || count > counts.back())) {
+            counts.push_back(count);
+        }
+    }
+    return counts;
+}
+
+
+template<int column_count, int row_count>
+void bench_matrix_loop() {
+    typedef FakeMatrixPinTraits Pins;
+    typedef KeyboardMatrix<column_count, row_count, int, Pins> Matrix;
+    for (int held : held_counts(column_count * row_count)) {
+        hold(row_count, held);
+        Matrix matrix(Pins::column_pins<column_count>(), Pins::row_pins<row_count>());
+        // Never back off, so that each call with the next millisecond is due.
+        matrix.set_scan_rate(ScanRate(1, 1));
+
+        // Settle so that what is measured is scanning a steady matrix.
+        millis_t millis = 0;
+        for (; millis <= 2 * debounce_millis; ++millis) {
+            matrix.loop(millis);
+        }
+
+        char params[100];
+        std::snprintf(params, sizeof params, "\"columns\": %d, \"rows\": %d, \"held\": %d", column_count, row_count, held);
+        Bench::run("KeyboardMatrix::loop", params, [&](long tick) {
+            matrix.loop(millis + tick);
+        });
+        do_not_optimize(matrix.pressed_switches().size());
+    }
+}
+
+
+template<int column_count, int row_count>
+void bench_record_from_switches() {
+    typedef KeyboardCortex<1, column_count, row_count> Cortex;
+    static typename Cortex::Keymap keymap;
+    for (int col = 0; col < column_count; ++col) {
+        for (int row = 0; row < row_count; ++row) {
+            int cell = col * row_count + row;
+            keymap[0][row][col] = cell % 16 == 15 ? KeymapEntry(MODIFIERKEY_SHIFT) : KeymapEntry(KEY_A + cell % 26);
+        }
+    }
+    Cortex cortex(keymap);
+
+    std::vector<Switch> switches;
+    for (int held : held_counts(column_count * row_count)) {
+        switches.clear();
+        for (int cell = 0; cell < held; ++cell) {
+            switches.push_back(Switch(cell / row_count, cell % row_count));
+        }
+        Switches pressed(switches.data(), switches.size());
+
+        char params[100];
+        std::snprintf(params, sizeof params, "\"columns\": %d, \"rows\": %d, \"held\": %d", column_count, row_count, held);
+        Bench::run("KeyboardCortex::record_from_switches", params, [&](long) {
+            keyboard_record record = cortex.record_from_switches(pressed);
+            do_not_optimize(record);
+        });
+    }
+}
+
+
+template<int column_count, int row_count>
+void bench_size() {
+    bench_matrix_loop<column_count, row_count>();
+    bench_record_from_switches<column_count, row_count>();
+}
+
+
+int main() {
+    bench_size<4, 4>();
+    bench_size<8, 6>();
+    bench_size<12, 6>();
+    bench_size<16, 8>();
+    bench_size<24, 8>();
+    return 0;
+}
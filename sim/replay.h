@@ -0,0 +1,187 @@
+/**
+ * Replays switch traces through the whole pipeline, faster than real time:
+ * KeyboardMatrix, then KeyboardCortex, then reports as KeyboardTraits would send them.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <array>
+#include <cstdio>
+#include <ostream>
+#include "Arduino.h"
+#include "fake_matrix.h"
+#include "hardware_traits.h"
+#include "keyboard_cortex.h"
+#include "keyboard_matrix.h"
+#include "switch_trace.h"
+
+
+/**
+ * Use in place of KeyboardTraits.
+ * Writes each report sent as a line of text: the time, the modifier flags,
+ * and the 6 key codes, all but the time in hex.
+ */
+class ReportStreamWriter: public KeyboardReports<ReportStreamWriter> {
+    std::ostream *out;
+    keyboard_record next;
+    millis_t millis;
+
+public:
+    explicit ReportStreamWriter(std::ostream &out_0): out(&out_0), next(), millis(0) {}
+
+    // When the next report is sent.
+    void set_millis(millis_t millis_0) {
+        millis = millis_0;
+    }
+
+    void set_modifier(modifier_flags_t flags) {
+        next.modifier_flags = flags;
+    }
+
+    void set_key1(scancode_t scancode) {
+        next.keys[0] = scancode;
+    }
+    void set_key2(scancode_t scancode) {
+        next.keys[1] = scancode;
+    }
+    void set_key3(scancode_t scancode) {
+        next.keys[2] = scancode;
+    }
+    void set_key4(scancode_t scancode) {
+        next.keys[3] = scancode;
+    }
+    void set_key5(scancode_t scancode) {
+        next.keys[4] = scancode;
+    }
+    void set_key6(scancode_t scancode) {
+        next.keys[5] = scancode;
+    }
+
+    void send_now() {
+        char line[64];
+        int length = std::snprintf(line, sizeof line, "%lu %04x %02x %02x %02x %02x %02x %02x\n",
+            static_cast<unsigned long>(millis), next.modifier_flags,
+            next.keys[0], next.keys[1], next.keys[2], next.keys[3], next.keys[4], next.keys[5]);
+        out->write(line, length);
+    }
+};
+
+
+/**
+ * What a replay did.
+ */
+struct ReplayStats {
+    unsigned long changes;  // Entries read from the trace.
+    unsigned long scans;  // Loops in which the matrix scanned, not counting reads of the rows while idle.
+    unsigned long events;  // Presses and releases after debouncing.
+    unsigned long reports;
+    millis_t simulated_millis;  // From the first entry until everything settled.
+
+    ReplayStats(): changes(0), scans(0), events(0), reports(0), simulated_millis(0) {}
+};
+
+
+/**
+ * Drives a simulated matrix from a trace on a virtual clock.
+ *
+ * The matrix is scanned every millisecond while anything is changing.
+ * Once nothing has changed for settle_millis, long enough for the debouncer to have
+ * stopped ignoring changes, and the matrix reports the switches as they are,
+ * the clock jumps to the next entry, so long pauses in typing cost nothing.
+ */
+template<int layer_count, int column_count, int row_count, class Debounce_t = LockoutDebounce<> >
+class Replay {
+public:
+    typedef KeyboardCortex<layer_count, column_count, row_count> Cortex;
+    // Static, as the matrix needs static pin functions, so only one replay at a time.
+    typedef FakeMatrixPinTraits Pins;
+    typedef KeyboardMatrix<column_count, row_count, int, Pins, Debounce_t> Matrix;
+
+private:
+    Matrix matrix;
+    SwitchEvents events;
+    Cortex cortex;
+    ReportStreamWriter reports;
+    millis_t settle_millis;
+    ReplayStats stats;
+
+public:
+    Replay(const typename Cortex::Keymap &keymap, std::ostream &reports_out, millis_t settle_millis_0 = debounce_millis):
+        matrix(Pins::column_pins<column_count>(), Pins::row_pins<row_count>()),
+        cortex(keymap), reports(reports_out), settle_millis(settle_millis_0)
+    {
+        Pins::reset();
+        matrix.publish_events(&events);
+    }
+
+    void set_scan_rate(const ScanRate &rate) {
+        matrix.set_scan_rate(rate);
+    }
+
+    /**
+     * Replay the whole trace, which must be for a matrix of this size.
+     */
+    ReplayStats run(SwitchTraceReader &trace) {
+        if (trace.column_count() != column_count || trace.row_count() != row_count) {
+            throw std::runtime_error("Switch trace is for a different size of matrix");
+        }
+        stats = ReplayStats();
+        SwitchTraceEntry entry;
+        bool has_entry = trace.next(entry);
+        millis_t start = entry.millis;
+        millis_t millis = start;
+        millis_t quiet_from = millis;  // When the matrix can next be left alone.
+        while (has_entry) {
+            while (has_entry && static_cast<long>(entry.millis - millis) <= 0) {
+                Pins::matrix().set_closed(entry.col, entry.row, entry.is_closed);
+                ++stats.changes;
+                quiet_from = millis + settle_millis;
+                has_entry = trace.next(entry);
+            }
+            step(millis);
+            if (has_entry && static_cast<long>(millis - quiet_from) >= 0 && is_settled()) {
+                millis = entry.millis;
+            } else {
+                ++millis;
+            }
+        }
+        while (static_cast<long>(millis - quiet_from) < 0 || !is_settled()) {
+            step(millis++);
+        }
+        stats.simulated_millis = millis - start;
+        return stats;
+    }
+
+private:
+    // Whether the matrix reports the switches as they are.
+    bool is_settled() const {
+        for (int col = 0; col < column_count; ++col) {
+            if (matrix.pressed_rows_in_column(col) != Pins::matrix().closed_rows(col)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void step(millis_t millis) {
+        if (matrix.loop(millis)) {
+            ++stats.scans;
+        }
+        SwitchEvent event;
+        while (events.pop(event)) {
+            cortex.apply(event);
+            ++stats.events;
+        }
+        keyboard_record record;
+        if (cortex.take_record(record)) {
+            reports.set_millis(millis);
+            if (reports.send_report(record)) {
+                ++stats.reports;
+            }
+        }
+    }
+};
+
+
+#endif // REPLAY_H
@@ -0,0 +1,126 @@
+/**
+ * Replays a switch trace through the keyboard and writes the reports it would send.
+ *
+ *     replay [TRACE [REPORTS]]      replay TRACE (default stdin), writing reports to REPORTS (default stdout)
+ *     replay --generate COUNT       write a trace of COUNT random keystrokes, with bounce, to stdout
+ *
+ * Statistics, including how fast the replay ran, are written to stderr.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include "Keyboard.h"
+#include "keymap.h"
+#include "replay.h"
+#include "switch_trace.h"
+
+
+// A 12 x 4 ortholinear layout, with numbers and symbols on a second layer.
+const int layer_count = 2;
+const int column_count = 12;
+const int row_count = 4;
+
+#define ___ KEY_TRANSPARENT
+
+constexpr Keymap<layer_count, column_count, row_count> replay_keymap = {{
+    {{
+        {{ KEY_TAB, KEY_Q, KEY_W, KEY_E, KEY_R, KEY_T, KEY_Y, KEY_U, KEY_I, KEY_O, KEY_P, KEY_BACKSPACE }},
+        {{ KEY_ESC, KEY_A, KEY_S, KEY_D, KEY_F, KEY_G, KEY_H, KEY_J, KEY_K, KEY_L, KEY_SEMICOLON, KEY_QUOTE }},
+        {{ MODIFIERKEY_SHIFT, KEY_Z, KEY_X, KEY_C, KEY_V, KEY_B, KEY_N, KEY_M, KEY_COMMA, KEY_PERIOD, KEY_SLASH, KEY_ENTER }},
+        {{ MODIFIERKEY_CTRL, MODIFIERKEY_ALT, MODIFIERKEY_GUI, ___, LAYER_MOMENTARY(1), KEY_SPACE, KEY_SPACE, LAYER_MOMENTARY(1), KEY_LEFT, KEY_DOWN, KEY_UP, KEY_RIGHT }},
+    }},
+    {{
+        {{ KEY_TILDE, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9, KEY_0, KEY_DELETE }},
+        {{ ___, KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, KEY_MINUS, KEY_EQUAL, KEY_LEFT_BRACE, KEY_RIGHT_BRACE, KEY_BACKSLASH }},
+        {{ ___, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12, ___, ___, ___, ___, ___ }},
+        {{ ___, ___, ___, ___, ___, ___, ___, ___, KEY_HOME, KEY_PAGE_DOWN, KEY_PAGE_UP, KEY_END }},
+    }},
+}};
+
+#undef ___
+
+
+/**
+ * Random typing: a key about every 120 ms, held for 60 to 120 ms,
+ * with contacts bouncing for up to 5 ms on press and release.
+ */
+void generate(unsigned long keystroke_count) {
+    std::mt19937 random(12345);
+    std::uniform_int_distribution<int> cells(0, column_count * row_count - 1);
+    std::uniform_int_distribution<int> gaps(60, 180);
+    std::uniform_int_distribution<int> holds(60, 120);
+    std::uniform_int_distribution<int> bounces(0, 3);
+
+    SwitchTraceWriter writer(std::cout, column_count, row_count);
+    millis_t millis = 1000;
+    for (unsigned long k = 0; k < keystroke_count; ++k) {
+        int cell = cells(random);
+        int col = cell / row_count;
+        int row = cell % row_count;
+        for (int edge = 0; edge < 2; ++edge) {
+            bool is_closed = edge == 0;
+            for (int bounce = bounces(random); bounce > 0; --bounce) {
+                writer.write(SwitchTraceEntry(millis++, col, row, is_closed));
+                writer.write(SwitchTraceEntry(millis++, col, row, !is_closed));
+            }
+            writer.write(SwitchTraceEntry(millis, col, row, is_closed));
+            millis += is_closed ? holds(random) : gaps(random);
+        }
+    }
+}
+
+
+int replay(std::istream &trace_in, std::ostream &reports_out) {
+    SwitchTraceReader trace(trace_in);
+    Replay<layer_count, column_count, row_count> replay(replay_keymap, reports_out);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ReplayStats stats = replay.run(trace);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::fprintf(stderr, "changes %lu, scans %lu, events %lu, reports %lu\n",
+        stats.changes, stats.scans, stats.events, stats.reports);
+    std::fprintf(stderr, "simulated %.1f s in %.3f s: %.0f scans/s, %.0f changes/s\n",
+        stats.simulated_millis / 1000.0, seconds, stats.scans / seconds, stats.changes / seconds);
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    std::ios::sync_with_stdio(false);
+    try {
+        if (argc == 3 && std::string(argv[1]) == "--generate") {
+            generate(std::strtoul(argv[2], nullptr, 10));
+            return 0;
+        }
+        if (argc > 3 || (argc > 1 && argv[1][0] == '-' && argv[1][1])) {
+            std::fprintf(stderr, "usage: %s [TRACE [REPORTS]] | --generate COUNT\n", argv[0]);
+            return 2;
+        }
+        std::ifstream trace_file;
+        if (argc > 1 && std::string(argv[1]) != "-") {
+            trace_file.open(argv[1], std::ios::binary);
+            if (!trace_file) {
+                std::fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[1]);
+                return 1;
+            }
+        }
+        std::ofstream reports_file;
+        if (argc > 2) {
+            reports_file.open(argv[2]);
+            if (!reports_file) {
+                std::fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[2]);
+                return 1;
+            }
+        }
+        return replay(trace_file.is_open() ? trace_file : std::cin, reports_file.is_open() ? reports_file : std::cout);
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+}
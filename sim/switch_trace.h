@@ -0,0 +1,151 @@
+/**
+ * Compact traces of the physical state of a keyboard's switches over time.
+ *
+ * A trace is a header followed by one record per switch opening or closing:
+ *
+ *     header: 'K' 'T' 'R' '1', column count, row count (a byte each)
+ *     record: varint(milliseconds since the previous record), varint(cell * 2 + is_closed)
+ *
+ * where cell is col * row_count + row, the first record's time is since 0,
+ * and varints are 7 bits a byte, lowest first, with the top bit set on all but the last.
+ * Switches closing at the same time have records 0 milliseconds apart.
+ * Typing takes about 2 bytes per change, so traces can be read as a stream.
+ */
+
+#ifndef SWITCH_TRACE_H
+#define SWITCH_TRACE_H
+
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include "hardware_traits.h"
+
+
+/**
+ * A switch being closed or opened. Unlike SwitchEvent these are raw readings,
+ * before any debouncing.
+ */
+struct SwitchTraceEntry {
+    millis_t millis;
+    char col;
+    char row;
+    bool is_closed;
+
+    SwitchTraceEntry(millis_t millis_0, int col_0, int row_0, bool is_closed_0):
+        millis(millis_0), col(col_0), row(row_0), is_closed(is_closed_0) {}
+    SwitchTraceEntry(): SwitchTraceEntry(0, 0, 0, false) {}
+
+    bool operator==(const SwitchTraceEntry &other) const {
+        return millis == other.millis && col == other.col && row == other.row && is_closed == other.is_closed;
+    }
+};
+
+
+class SwitchTraceWriter {
+    std::ostream &out;
+    int row_count;
+    millis_t last_millis;
+
+public:
+    SwitchTraceWriter(std::ostream &out_0, int column_count, int row_count_0):
+        out(out_0), row_count(row_count_0), last_millis(0)
+    {
+        out.write("KTR1", 4);
+        out.put(char(column_count));
+        out.put(char(row_count));
+    }
+
+    /**
+     * Entries must be written in order of time.
+     */
+    void write(const SwitchTraceEntry &entry) {
+        write_varint(entry.millis - last_millis);
+        write_varint((entry.col * row_count + entry.row) * 2 + (entry.is_closed ? 1 : 0));
+        last_millis = entry.millis;
+    }
+
+private:
+    void write_varint(unsigned long value) {
+        while (value >= 0x80) {
+            out.put(char(0x80 | (value & 0x7F)));
+            value >>= 7;
+        }
+        out.put(char(value));
+    }
+};
+
+
+/**
+ * Reads entries one at a time, so traces need not fit in memory.
+ * Throws std::runtime_error if the trace is malformed.
+ */
+class SwitchTraceReader {
+    std::istream &in;
+    int columns;
+    int rows;
+    millis_t last_millis;
+
+public:
+    explicit SwitchTraceReader(std::istream &in_0): in(in_0), columns(0), rows(0), last_millis(0) {
+        char magic[4];
+        if (!in.read(magic, 4) || magic[0] != 'K' || magic[1] != 'T' || magic[2] != 'R' || magic[3] != '1') {
+            throw std::runtime_error("Not a switch trace");
+        }
+        columns = read_byte();
+        rows = read_byte();
+        if (columns <= 0 || rows <= 0) {
+            throw std::runtime_error("Switch trace has no switches");
+        }
+    }
+
+    int column_count() const {
+        return columns;
+    }
+
+    int row_count() const {
+        return rows;
+    }
+
+    /**
+     * Read the next entry in to result. Returns false at the end of the trace.
+     */
+    bool next(SwitchTraceEntry &result) {
+        if (in.peek() == std::istream::traits_type::eof()) {
+            return false;
+        }
+        last_millis += read_varint();
+        unsigned long code = read_varint();
+        unsigned long cell = code / 2;
+        if (cell >= static_cast<unsigned long>(columns * rows)) {
+            throw std::runtime_error("Switch trace has switch outside matrix");
+        }
+        result = SwitchTraceEntry(last_millis, cell / rows, cell % rows, code & 1);
+        return true;
+    }
+
+private:
+    int read_byte() {
+        int byte = in.get();
+        if (byte == std::istream::traits_type::eof()) {
+            throw std::runtime_error("Switch trace is truncated");
+        }
+        return byte;
+    }
+
+    unsigned long read_varint() {
+        unsigned long value = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (shift >= 8 * static_cast<int>(sizeof value)) {
+                throw std::runtime_error("Switch trace has varint too long");
+            }
+            int byte = read_byte();
+            value |= static_cast<unsigned long>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+    }
+};
+
+
+#endif // SWITCH_TRACE_H
@@ -3,34 +3,69 @@
 
 #include "Arduino.h"
 #include "hardware_traits.h"
+#include "timer_wheel.h"
 
 
-template<typename P = int, class T = PinTraits>
+/**
+ * Blinks an LED, in step with every other BlinkingThing with the same timing:
+ * dark for dark_millis then lit for lit_millis, in cycles starting at time 0.
+ *
+ * Driven by a timer on a shared wheel; pass the timer's tag on to timer_expired,
+ * or attach it to a TimerDispatcher to have that done.
+ */
+template<typename P = int, class T = PinTraits, class Wheel_t = TimerWheel<4> >
 class BlinkingThing {
     P pin;
+    Wheel_t *wheel;
+    uint16_t tag;
     unsigned long dark_millis;
     unsigned long lit_millis;
 
     bool is_lit;
-    unsigned long last_modified;
+    bool running;  // Whether a timer is scheduled for the next change.
 
 public:
-    BlinkingThing(P pin0, unsigned long dark_millis0, unsigned long lit_millis0):
-        pin(pin0), dark_millis(dark_millis0), lit_millis(lit_millis0),
-        is_lit(false), last_modified(0)
+    /**
+     * Starts blinking, unless the wheel is full: check is_running.
+     */
+    BlinkingThing(Wheel_t &wheel0, uint16_t tag0, P pin0, unsigned long dark_millis0, unsigned long lit_millis0):
+        pin(pin0), wheel(&wheel0), tag(tag0), dark_millis(dark_millis0), lit_millis(lit_millis0), is_lit(false), running(false)
     {
         T::pinMode(pin, OUTPUT);
-        T::digitalWrite(pin, LOW);
-
+        start();
     }
 
-    void loop(unsigned long millis) {
-        unsigned long within_cycle = millis % (dark_millis + lit_millis);
-        bool next_is_lit = within_cycle >= dark_millis;
-        if (next_is_lit != is_lit) {
-            is_lit = next_is_lit;
-            T::digitalWrite(pin, is_lit ? HIGH : LOW);
+    /**
+     * Join the cycle part way through. After this it is kept up by the timer.
+     * Returns false if the wheel is full, so it cannot be; try again once there is room.
+     */
+    bool start() {
+        if (running) {
+            return true;
         }
+        millis_t within_cycle = wheel->now() % (dark_millis + lit_millis);
+        is_lit = within_cycle >= dark_millis;
+        T::digitalWrite(pin, is_lit ? HIGH : LOW);
+        running = wheel->schedule(wheel->now() - within_cycle + (is_lit ? dark_millis + lit_millis : dark_millis), tag);
+        return running;
+    }
+
+    /**
+     * Called when the timer with this thing's tag expires.
+     * If the wheel has filled up meanwhile the LED stops changing, and is_running becomes false.
+     */
+    void timer_expired(millis_t deadline) {
+        is_lit = !is_lit;
+        T::digitalWrite(pin, is_lit ? HIGH : LOW);
+        running = wheel->schedule(deadline + (is_lit ? lit_millis : dark_millis), tag);
+    }
+
+    /**
+     * Whether it is blinking. False if the wheel was full when a change had to be scheduled;
+     * call start to join the cycle again.
+     */
+    bool is_running() const {
+        return running;
     }
 };
 
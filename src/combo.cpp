@@ -0,0 +1,5 @@
+/**
+ * Implementation of combos.
+ */
+
+#include "combo.h"
@@ -0,0 +1,301 @@
+/**
+ * Combos, also called chords: switches pressed together that mean something else.
+ */
+
+#ifndef COMBO_H
+#define COMBO_H
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <stdint.h>
+#include "hardware_traits.h"
+#include "keyboard_matrix.h"
+#include "keymap.h"
+
+
+/**
+ * Bitmask of switches, with bit col * row_count + row for each,
+ * so only the first 64 switches can be part of a combo.
+ */
+typedef uint64_t combo_mask_t;
+
+/**
+ * The bit for a switch in a combo_mask_t.
+ * A switch beyond the first 64 is a compile-time error in a constexpr combo,
+ * and throws std::out_of_range at run time.
+ */
+template<int row_count>
+constexpr combo_mask_t combo_switch(int col, int row) {
+    return col * row_count + row < 64 ? combo_mask_t(1) << (col * row_count + row)
+        : throw std::out_of_range("Switch cannot be part of a combo");
+}
+
+
+/**
+ * Declares a combo: pressing all of the switches within the window means entry,
+ * instead of what each of them means.
+ */
+struct Combo {
+    combo_mask_t switches;
+    KeymapEntry entry;
+};
+
+
+/**
+ * The combos for a ComboResolver, in order of their masks so they can be found by binary search.
+ *
+ * Made from an array of combos declared constexpr at namespace scope, which is not copied.
+ * Combos out of order are a compile-time error in a constexpr table,
+ * and throw std::invalid_argument at run time.
+ */
+class ComboTable {
+    const Combo *first;
+    size_t count;
+
+public:
+    template<size_t count_0>
+    constexpr ComboTable(const Combo (&combos)[count_0]):
+        first(combos),
+        count(is_in_order(combos, count_0) ? count_0 : throw std::invalid_argument("Combos must be in order of switches"))
+    {}
+
+    const Combo *begin() const {
+        return first;
+    }
+
+    const Combo *end() const {
+        return first + count;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    static constexpr bool is_in_order(const Combo *first, size_t count) {
+        return count < 2 || (first[0].switches < first[1].switches && is_in_order(first + 1, count - 1));
+    }
+};
+
+
+/**
+ * How long after the first switch of a combo is pressed the rest can be.
+ */
+const millis_t combo_millis = 50;
+
+
+/**
+ * Stage between KeyboardMatrix and KeyboardCortex that replaces combos with their entries.
+ *
+ * Combos come in a ComboTable, declared constexpr so it stays in flash:
+ *
+ *   constexpr Combo combo_list[] = {
+ *       {combo_switch<rows>(0, 0) | combo_switch<rows>(1, 0), KEY_ESC},
+ *       {combo_switch<rows>(1, 0) | combo_switch<rows>(2, 0), KEY_TAB},
+ *   };
+ *   constexpr ComboTable combos(combo_list);
+ *   ComboResolver<rows> resolver(combos);
+ *
+ * Presses of switches in some combo are held back for as long as some combo
+ * could still be completed, so other switches are passed on straight away.
+ * A combo is pressed as soon as it is complete and no bigger combo could be,
+ * or when the window is up. Otherwise the presses held back are passed on as they were.
+ * The combo's entry is pressed on its lowest switch, and released when
+ * the first of its switches is released.
+ *
+ * Events are passed on to a sink with the same apply functions as KeyboardCortex.
+ * Call loop every time round Arduino's loop to resolve combos whose window is up.
+ *
+ * Work is only done on presses and releases, and then each combo costs one AND and compare:
+ * any combo that includes the switches held back has a mask at least as big,
+ * so only the end of the table from there is searched.
+ */
+template<int row_count, int capacity = 4>
+class ComboResolver {
+    // A combo that has been pressed.
+    struct Active {
+        combo_mask_t held;  // Switches of the combo not yet released.
+        SwitchEvent press;  // As passed on.
+        bool is_released;
+    };
+
+    const Combo *combos;
+    const Combo *combos_end;
+    combo_mask_t combo_switches;  // Switches in any combo.
+    millis_t window;
+
+    combo_mask_t pending;  // Switches held back.
+    std::array<SwitchEvent, capacity> pending_presses;  // In the order pressed.
+    int pending_count;
+    millis_t deadline;
+    std::array<Active, capacity> active;
+    int active_count;
+
+public:
+    /**
+     * The combos are not copied, so must outlive the resolver.
+     */
+    explicit ComboResolver(const ComboTable &table, millis_t window_0 = combo_millis):
+        combos(table.begin()), combos_end(table.end()), combo_switches(0), window(window_0),
+        pending(0), pending_presses(), pending_count(0), deadline(0), active(), active_count(0)
+    {
+        for (const Combo *combo = combos; combo != combos_end; ++combo) {
+            combo_switches |= combo->switches;
+        }
+    }
+
+    /**
+     * Pass on the event, or hold it back if it could be part of a combo.
+     */
+    template<class Sink_t>
+    void apply(const SwitchEvent &event, Sink_t &sink) {
+        combo_mask_t bit = bit_for(event);
+        if (event.is_press) {
+            if (!(bit & combo_switches)) {
+                resolve(sink);
+                sink.apply(event);
+                return;
+            }
+            if (!is_possible(pending | bit) || pending_count == capacity) {
+                resolve(sink);
+            }
+            if (!is_possible(bit)) {
+                sink.apply(event);
+                return;
+            }
+            if (!pending) {
+                deadline = event.millis + window;
+            }
+            pending |= bit;
+            pending_presses[pending_count++] = event;
+            if (find(pending) && !is_possible_beyond(pending)) {
+                resolve(sink);
+            }
+        } else {
+            if (bit & pending) {
+                resolve(sink);
+            }
+            if (!release_active(bit, event.millis, sink)) {
+                sink.apply(event);
+            }
+        }
+    }
+
+    template<class Sink_t>
+    void apply(SwitchEvents &events, Sink_t &sink) {
+        SwitchEvent event;
+        while (events.pop(event)) {
+            apply(event, sink);
+        }
+    }
+
+    /**
+     * Resolve the switches held back if their window is up.
+     */
+    template<class Sink_t>
+    void loop(millis_t millis, Sink_t &sink) {
+        if (pending && static_cast<long>(millis - deadline) >= 0) {
+            resolve(sink);
+        }
+    }
+
+    /**
+     * Whether any presses are held back.
+     */
+    bool is_pending() const {
+        return pending != 0;
+    }
+
+private:
+    static combo_mask_t bit_for(const SwitchEvent &event) {
+        int cell = event.col * row_count + event.row;
+        return cell < 64 ? combo_mask_t(1) << cell : 0;
+    }
+
+    // The first combo whose mask is at least switches.
+    const Combo *lower_bound(combo_mask_t switches) const {
+        return std::lower_bound(combos, combos_end, switches,
+            [](const Combo &combo, combo_mask_t mask) { return combo.switches < mask; });
+    }
+
+    // The combo of exactly these switches, if any.
+    const Combo *find(combo_mask_t switches) const {
+        const Combo *combo = lower_bound(switches);
+        return combo != combos_end && combo->switches == switches ? combo : nullptr;
+    }
+
+    // Whether some combo includes all these switches.
+    bool is_possible(combo_mask_t switches) const {
+        for (const Combo *combo = lower_bound(switches); combo != combos_end; ++combo) {
+            if ((combo->switches & switches) == switches) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether some combo includes these switches and more.
+    bool is_possible_beyond(combo_mask_t switches) const {
+        for (const Combo *combo = lower_bound(switches + 1); combo != combos_end; ++combo) {
+            if ((combo->switches & switches) == switches) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Press the combo held back, or pass on the presses as they were.
+    template<class Sink_t>
+    void resolve(Sink_t &sink) {
+        if (!pending) {
+            return;
+        }
+        const Combo *combo = find(pending);
+        if (combo && active_count < capacity) {
+            // Pressed on the switch with the lowest bit, whichever was pressed first.
+            SwitchEvent press = pending_presses[0];
+            for (int k = 1; k < pending_count; ++k) {
+                if (bit_for(pending_presses[k]) < bit_for(press)) {
+                    press.col = pending_presses[k].col;
+                    press.row = pending_presses[k].row;
+                }
+            }
+            press.millis = pending_presses[pending_count - 1].millis;
+            active[active_count++] = Active {pending, press, false};
+            sink.apply(press, combo->entry);
+        } else {
+            for (int k = 0; k < pending_count; ++k) {
+                sink.apply(pending_presses[k]);
+            }
+        }
+        pending = 0;
+        pending_count = 0;
+    }
+
+    // Returns true if the switch was part of a combo pressed.
+    template<class Sink_t>
+    bool release_active(combo_mask_t bit, millis_t millis, Sink_t &sink) {
+        for (int k = 0; k < active_count; ++k) {
+            Active &combo = active[k];
+            if (!(combo.held & bit)) {
+                continue;
+            }
+            if (!combo.is_released) {
+                combo.is_released = true;
+                sink.apply(SwitchEvent(combo.press.col, combo.press.row, false, millis));
+            }
+            combo.held &= ~bit;
+            if (!combo.held) {
+                for (--active_count; k < active_count; ++k) {
+                    active[k] = active[k + 1];
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+
+#endif // COMBO_H
@@ -0,0 +1,5 @@
+/**
+ * Implementation of debounce policies.
+ */
+
+#include "debounce.h"
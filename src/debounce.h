@@ -0,0 +1,171 @@
+/**
+ * Policies for debouncing the switches of a keyboard matrix.
+ *
+ * Each policy has a nested Debouncer template that the matrix instantiates
+ * with its size and the type it uses for a column's bitmask of rows.
+ * The matrix calls Debouncer::update once per column per scan with the rows
+ * that read as closed and the rows it has reported as pressed so far,
+ * and gets back the rows to report as pressed from now on.
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <array>
+#include "hardware_traits.h"
+#include "timer_wheel.h"
+
+
+/**
+ * How long to ignore changes after switch changes state.
+ */
+const millis_t debounce_millis = 50;
+
+
+/**
+ * Reports a change as soon as it is seen, then ignores
+ * further changes to that switch until window has passed.
+ */
+template<millis_t window = debounce_millis>
+struct LockoutDebounce {
+    template<int column_count, int row_count, typename Bits_t>
+    class Debouncer {
+        // Bit j of pending[i] is set if switch (i, j) changed within window.
+        std::array<Bits_t, column_count> pending;
+        // When each pending switch stops being ignored, tagged with i * row_count + j.
+        // Not shared, unlike a BlinkingThing's: every switch can bounce at once, so a shared
+        // wheel would still need an entry for each, and if others filled it a switch would stay ignored.
+        TimerWheel<column_count * row_count> expiry;
+
+    public:
+        Debouncer(): pending(), expiry() {}
+
+        Bits_t update(int col, Bits_t sampled, Bits_t reported, millis_t millis) {
+            // Only does any work when a switch's time is up.
+            expiry.loop(millis, [this](uint16_t cell, millis_t) {
+                pending[cell / row_count] &= ~(Bits_t(1) << (cell % row_count));
+            });
+            Bits_t changed = (sampled ^ reported) & ~pending[col];
+            if (changed) {
+                pending[col] |= changed;
+                Bits_t bits = changed;
+                for (int j = 0; bits; ++j, bits >>= 1) {
+                    if (bits & 1) {
+                        // Cannot be full, as there is room for every switch.
+                        expiry.schedule(millis + window, col * row_count + j);
+                    }
+                }
+            }
+            return reported ^ changed;
+        }
+    };
+};
+
+
+/**
+ * Reports a change once a switch has read the same way for 4 scans in a row.
+ *
+ * Uses a 2-bit counter per switch, stored bit-sliced as two bitmasks per column
+ * (a vertical counter), so a whole column is counted with a handful of word operations
+ * however many of its switches are bouncing. Unlike a lockout it rejects a glitch
+ * lasting fewer than 4 scans, rather than reporting it and then ignoring the recovery.
+ */
+struct VerticalCounterDebounce {
+    static const int sample_count = 4;
+
+    template<int column_count, int row_count, typename Bits_t>
+    class Debouncer {
+        // Count down from 3 for switches whose reading differs from what was reported;
+        // low bits in count0 and high bits in count1. Reset to 3 when the reading agrees.
+        std::array<Bits_t, column_count> count0;
+        std::array<Bits_t, column_count> count1;
+
+    public:
+        Debouncer() {
+            count0.fill(Bits_t(~Bits_t(0)));
+            count1.fill(Bits_t(~Bits_t(0)));
+        }
+
+        Bits_t update(int col, Bits_t sampled, Bits_t reported, millis_t) {
+            Bits_t differs = sampled ^ reported;
+            count0[col] = ~(count0[col] & differs);
+            count1[col] = count0[col] ^ (count1[col] & differs);
+            Bits_t toggled = differs & count0[col] & count1[col];
+            return reported ^ toggled;
+        }
+    };
+};
+
+
+/**
+ * Reports a press once the switch has read closed for press_window,
+ * and a release once it has read open for release_window.
+ * A reading that goes back to agreeing with what was reported restarts the wait.
+ *
+ * A window of 0 makes that edge eager: it is reported the first time it is seen,
+ * adding no latency. Unlike LockoutDebounce nothing is ignored after a change,
+ * so a key tapped again quickly is not lost.
+ */
+template<millis_t press_window, millis_t release_window>
+struct IntegratingDebounce {
+    template<int column_count, int row_count, typename Bits_t>
+    class Debouncer {
+        // Bit j of unsettled[i] is set if switch (i, j) reads differently from what was reported.
+        std::array<Bits_t, column_count> unsettled;
+        std::array<millis_t, column_count * row_count> since_millis;  // When switch (i, j) started to differ, at [i * row_count + j].
+
+    public:
+        Debouncer(): unsettled(), since_millis() {}
+
+        Bits_t update(int col, Bits_t sampled, Bits_t reported, millis_t millis) {
+            Bits_t differs = sampled ^ reported;
+            Bits_t started = differs & ~unsettled[col];
+            unsettled[col] = differs;
+            if (!differs) {
+                return reported;
+            }
+
+            Bits_t toggled = 0;
+            if (press_window == 0) {
+                toggled |= differs & sampled;
+            }
+            if (release_window == 0) {
+                toggled |= differs & ~sampled;
+            }
+            Bits_t waiting = differs & ~toggled;
+            for (int j = 0; waiting; ++j, waiting >>= 1) {
+                if (!(waiting & 1)) {
+                    continue;
+                }
+                Bits_t bit = Bits_t(1) << j;
+                millis_t &since = since_millis[col * row_count + j];
+                if (started & bit) {
+                    since = millis;
+                }
+                if (millis - since >= ((sampled & bit) ? press_window : release_window)) {
+                    toggled |= bit;
+                }
+            }
+            unsettled[col] &= ~toggled;
+            return reported ^ toggled;
+        }
+    };
+};
+
+
+/**
+ * Press reported at once; release deferred until the switch has read open for release_window.
+ * Lowest latency for key presses.
+ */
+template<millis_t release_window = 5>
+using EagerPressDebounce = IntegratingDebounce<0, release_window>;
+
+/**
+ * Press deferred until the switch has read closed for press_window; release reported at once.
+ * Rejects noise that would otherwise register as a press.
+ */
+template<millis_t press_window = 5>
+using EagerReleaseDebounce = IntegratingDebounce<press_window, 0>;
+
+
+#endif // DEBOUNCE_H
@@ -0,0 +1,5 @@
+/**
+ * Implementation of ghost filter policies.
+ */
+
+#include "ghost_filter.h"
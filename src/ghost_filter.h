@@ -0,0 +1,91 @@
+/**
+ * Policies for coping with ghosting in a keyboard matrix without diodes.
+ *
+ * Without a diode on each switch, current flows backwards through closed switches,
+ * so holding three corners of a rectangle of switches makes the fourth read as closed too.
+ * Every column connected that way reads the same rows, so a ghost always shows up
+ * as two columns that share two or more closed rows.
+ *
+ * Each policy has a nested Filter template that the matrix instantiates
+ * with its size and the type it uses for a column's bitmask of rows.
+ * If Filter::needs_whole_scan is true the matrix reads every column first,
+ * then calls Filter::filter with all the readings and the rows reported as pressed so far,
+ * before debouncing any of them.
+ */
+
+#ifndef GHOST_FILTER_H
+#define GHOST_FILTER_H
+
+#include <array>
+
+
+/**
+ * Takes every closed switch at face value, as is right when each switch has a diode.
+ * The matrix debounces each column as soon as it is read.
+ */
+struct NoGhostFilter {
+    template<int column_count, typename Bits_t>
+    struct Filter {
+        static const bool needs_whole_scan = false;
+
+        void filter(std::array<Bits_t, column_count> &, const std::array<Bits_t, column_count> &) {}
+    };
+};
+
+
+/**
+ * Finds the switches that could be ghosts and leaves them as they were reported,
+ * so a phantom press never gets as far as the debouncer.
+ *
+ * The switches held back are those in rows shared by two columns that have
+ * at least two closed rows in common. Switches already pressed stay pressed,
+ * and new presses among them wait until the ambiguity clears.
+ * Switches elsewhere are unaffected.
+ *
+ * Costs one AND and one test for two or more bits per pair of columns.
+ */
+struct RectangleGhostFilter {
+    template<int column_count, typename Bits_t>
+    class Filter {
+        // Rows that could not be trusted in each column at the last scan.
+        std::array<Bits_t, column_count> ambiguous;
+
+    public:
+        static const bool needs_whole_scan = true;
+
+        Filter(): ambiguous() {}
+
+        void filter(std::array<Bits_t, column_count> &sampled, const std::array<Bits_t, column_count> &reported) {
+            find_ambiguous(sampled, ambiguous);
+            for (int i = 0; i < column_count; ++i) {
+                sampled[i] = (sampled[i] & ~ambiguous[i]) | (reported[i] & ambiguous[i]);
+            }
+        }
+
+        /**
+         * Bitmask of rows in this column that were held back at the last scan.
+         */
+        Bits_t ambiguous_rows(int col) const {
+            return ambiguous[col];
+        }
+
+        static void find_ambiguous(const std::array<Bits_t, column_count> &sampled, std::array<Bits_t, column_count> &result) {
+            result.fill(0);
+            for (int i = 0; i < column_count; ++i) {
+                if (!(sampled[i] & (sampled[i] - 1))) {
+                    continue;  // Fewer than two rows, so it cannot share two.
+                }
+                for (int k = i + 1; k < column_count; ++k) {
+                    Bits_t common = sampled[i] & sampled[k];
+                    if (common & (common - 1)) {
+                        result[i] |= common;
+                        result[k] |= common;
+                    }
+                }
+            }
+        }
+    };
+};
+
+
+#endif // GHOST_FILTER_H
@@ -6,11 +6,17 @@
 * and has static functions that call the global ones.
 * In tests a different traits class is used that instead
 * operates on objects owned by the test fixture.
+*
+* The exception is keyboard traits, which get send_report from KeyboardReports
+* and so remember the last report sent: a sketch has one KeyboardTraits object
+* and passes it by reference to whatever sends reports.
 */
 
 #ifndef HARDWARE_TRAITS_H
 #define HARDWARE_TRAITS_H
 
+#include <array>
+#include <type_traits>
 #include "Arduino.h"
 #include "Keyboard.h"
 
@@ -19,6 +25,111 @@ typedef unsigned long millis_t;
 typedef uint16_t modifier_flags_t;
 typedef uint8_t scancode_t;
 
+
+const int usb_rollover_max = 6;
+
+/*
+* The contents of a USB keyboard report.
+*/
+struct keyboard_record {
+    modifier_flags_t modifier_flags;
+    std::array<scancode_t, usb_rollover_max> keys;
+
+    keyboard_record():
+        modifier_flags(0), keys({})
+    {}
+    keyboard_record(modifier_flags_t modifier_flags, std::array<scancode_t, usb_rollover_max> initial_keys):
+        modifier_flags(modifier_flags), keys(initial_keys)
+    {}
+
+    // Add key in the first free slot. Returns false if there is no room.
+    bool add_key(scancode_t scancode) {
+        for (auto &key : keys) {
+            if (!key) {
+                key = scancode;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Remove key, moving later keys down to fill the gap. Returns false if it was not there.
+    bool remove_key(scancode_t scancode) {
+        int k = 0;
+        while (k < usb_rollover_max && keys[k] != scancode) {
+            ++k;
+        }
+        if (k == usb_rollover_max) {
+            return false;
+        }
+        for (; k < usb_rollover_max - 1; ++k) {
+            keys[k] = keys[k + 1];
+        }
+        keys[k] = 0;
+        return true;
+    }
+
+    bool operator==(const keyboard_record &other) const {
+        return modifier_flags == other.modifier_flags && keys == other.keys;
+    }
+    bool operator!=(const keyboard_record &other) const {
+        return !(*this == other);
+    }
+};
+
+
+/*
+* Scancodes up to this are covered by nkro_record.
+* Includes all the usage codes from KEY_A (0x04) to KEY_F24 (0x73).
+*/
+const int nkro_scancode_count = 128;
+
+/*
+* The contents of an N-key rollover report:
+* a bitmap with bit n set if the key with scancode n is pressed.
+* Any number of keys can be down, and adding, removing and comparing
+* are done a 32-bit word at a time.
+*/
+struct nkro_record {
+    modifier_flags_t modifier_flags;
+    std::array<uint32_t, nkro_scancode_count / 32> key_bits;
+
+    nkro_record():
+        modifier_flags(0), key_bits()
+    {}
+
+    // Returns false if the key is already down, so that a second switch with the same key
+    // can take over when the first is released, or if the code is beyond nkro_scancode_count,
+    // which has no bit and is left out, as remove_key leaves it out.
+    bool add_key(scancode_t scancode) {
+        if (scancode >= nkro_scancode_count || has_key(scancode)) {
+            return false;
+        }
+        key_bits[scancode >> 5] |= uint32_t(1) << (scancode & 31);
+        return true;
+    }
+
+    // Returns false if it was not there.
+    bool remove_key(scancode_t scancode) {
+        if (!has_key(scancode)) {
+            return false;
+        }
+        key_bits[scancode >> 5] &= ~(uint32_t(1) << (scancode & 31));
+        return true;
+    }
+
+    bool has_key(scancode_t scancode) const {
+        return scancode < nkro_scancode_count && (key_bits[scancode >> 5] >> (scancode & 31)) & 1;
+    }
+
+    bool operator==(const nkro_record &other) const {
+        return modifier_flags == other.modifier_flags && key_bits == other.key_bits;
+    }
+    bool operator!=(const nkro_record &other) const {
+        return !(*this == other);
+    }
+};
+
 /*
 * Defines how to access the I/O pins.
 * This version just calls the gloabl functions supplied by Arduino.
@@ -42,10 +153,276 @@ struct PinTraits {
     static int digitalRead(int pin) {
         return ::digitalRead(pin);
     }
+
+    // Optional: pins that share an I/O port can be read together
+    // with a single read of the port's input register.
+    // Traits without these functions are read one pin at a time.
+    // The types are those of the core, as ports are 8 bits on AVR but 32 on ARM.
+    typedef std::decay<decltype(digitalPinToPort(0))>::type port_t;
+    typedef std::decay<decltype(digitalPinToBitMask(0))>::type port_bits_t;
+
+    // Returns the port the pin belongs to, or port_t() if none.
+    static port_t digitalPinPort(int pin) {
+        return digitalPinToPort(pin);
+    }
+
+    // Returns the bit in the port's value that corresponds to this pin.
+    static port_bits_t digitalPinBitMask(int pin) {
+        return digitalPinToBitMask(pin);
+    }
+
+    // Returns the values of all the pins on the port, one bit per pin.
+    static port_bits_t readPort(port_t port) {
+        return *portInputRegister(port);
+    }
+};
+
+
+/*
+* PinTraits that also attach an interrupt to each row pin while the matrix is idle,
+* so a sketch can put the processor to sleep until a switch closes.
+*
+* The interrupt only wakes the processor: the matrix reads the rows on every loop
+* while idle whether or not it fires, so a switch that closed before it was attached,
+* or a row pin that cannot raise an interrupt, costs nothing but the wake-up.
+*/
+struct WakePinTraits: PinTraits {
+    // Called for each row pin when the matrix goes idle and when it wakes.
+    static void attachWakeInterrupt(int pin) {
+        int interrupt = digitalPinToInterrupt(pin);
+        if (interrupt != NOT_AN_INTERRUPT) {
+            attachInterrupt(interrupt, wake, FALLING);
+        }
+    }
+
+    static void detachWakeInterrupt(int pin) {
+        int interrupt = digitalPinToInterrupt(pin);
+        if (interrupt != NOT_AN_INTERRUPT) {
+            detachInterrupt(interrupt);
+        }
+    }
+
+private:
+    // Nothing to do: being interrupted is what wakes the processor.
+    static void wake() {}
+};
+
+
+/*
+* Defines how to read the time at finer grain than millis.
+* This version just calls the global function supplied by Arduino.
+* In tests it is replaced with a fake.
+*/
+struct ClockTraits {
+    // Microseconds since start-up. Wraps round, so only differences are meaningful.
+    static unsigned long micros() {
+        return ::micros();
+    }
+};
+
+
+/*
+* List of pin numbers known at compile time.
+*/
+template<int... pins>
+struct PinList {
+    static const int count = sizeof...(pins);
+};
+
+/*
+* PinAt<PinList<...>, i>::value is the pin at index i of the list.
+*/
+template<class List, int index>
+struct PinAt;
+
+template<int first, int... rest>
+struct PinAt<PinList<first, rest...>, 0> {
+    static const int value = first;
+};
+
+template<int first, int... rest, int index>
+struct PinAt<PinList<first, rest...>, index> {
+    static const int value = PinAt<PinList<rest...>, index - 1>::value;
+};
+
+
+/*
+* Defines how to access pins whose numbers are known at compile time.
+* Given constant pin numbers the Teensy *Fast functions compile
+* to a single load or store of the port register.
+*/
+struct FastPinTraits {
+    template<int pin>
+    static void pinMode(int mode) {
+        ::pinMode(pin, mode);
+    }
+
+    template<int pin>
+    static void digitalWrite(int value) {
+        digitalWriteFast(pin, value);
+    }
+
+    template<int pin>
+    static int digitalRead() {
+        return digitalReadFast(pin);
+    }
+};
+
+
+/*
+* Pins for a keyboard matrix fixed at compile time,
+* for use as the traits of a KeyboardMatrix created with no pin arguments.
+*
+* The column pins are open-drain outputs: writing LOW pulls the column down
+* and writing HIGH lets it float. So strobing a column is two fast writes
+* instead of two calls to pinMode.
+*
+* Fast_t is FastPinTraits, or a fake in tests.
+*/
+template<class ColumnPins, class RowPins, class Fast_t = FastPinTraits>
+struct StaticMatrixPinTraits {
+    typedef ColumnPins column_pins_t;
+    typedef RowPins row_pins_t;
+
+    static void set_up() {
+        set_up_columns(Index<0>());
+        set_up_rows(Index<0>());
+    }
+
+    // Returns bitmask of the rows that are LOW while the column is pulled LOW.
+    template<int column, typename Bits_t>
+    static Bits_t read_column() {
+        Fast_t::template digitalWrite<PinAt<ColumnPins, column>::value>(LOW);
+        Bits_t result = read_rows<Bits_t>(Index<0>());
+        Fast_t::template digitalWrite<PinAt<ColumnPins, column>::value>(HIGH);
+        return result;
+    }
+
+    // Pull all the columns LOW, or let them all float.
+    static void write_all_columns(int value) {
+        write_columns(value, Index<0>());
+    }
+
+    // Returns bitmask of the rows that are LOW, leaving the columns as they are.
+    template<typename Bits_t>
+    static Bits_t read_all_rows() {
+        return read_rows<Bits_t>(Index<0>());
+    }
+
+private:
+    template<int i>
+    struct Index {};
+
+    static void set_up_columns(Index<ColumnPins::count>) {}
+
+    template<int i>
+    static void set_up_columns(Index<i>) {
+        Fast_t::template pinMode<PinAt<ColumnPins, i>::value>(OUTPUT_OPENDRAIN);
+        Fast_t::template digitalWrite<PinAt<ColumnPins, i>::value>(HIGH);
+        set_up_columns(Index<i + 1>());
+    }
+
+    static void write_columns(int, Index<ColumnPins::count>) {}
+
+    template<int i>
+    static void write_columns(int value, Index<i>) {
+        Fast_t::template digitalWrite<PinAt<ColumnPins, i>::value>(value);
+        write_columns(value, Index<i + 1>());
+    }
+
+    static void set_up_rows(Index<RowPins::count>) {}
+
+    template<int j>
+    static void set_up_rows(Index<j>) {
+        Fast_t::template pinMode<PinAt<RowPins, j>::value>(INPUT_PULLUP);
+        set_up_rows(Index<j + 1>());
+    }
+
+    template<typename Bits_t>
+    static Bits_t read_rows(Index<RowPins::count>) {
+        return 0;
+    }
+
+    template<typename Bits_t, int j>
+    static Bits_t read_rows(Index<j>) {
+        Bits_t bit = Fast_t::template digitalRead<PinAt<RowPins, j>::value>() == LOW ? Bits_t(1) << j : 0;
+        return bit | read_rows<Bits_t>(Index<j + 1>());
+    }
+};
+
+
+/*
+* HasStaticPins<T>::value is true if traits class T fixes the pins at compile time.
+*/
+template<class T>
+struct HasStaticPins {
+    template<class U> static char test(typename U::column_pins_t *);
+    template<class U> static long test(...);
+    static const bool value = sizeof(test<T>(0)) == 1;
+};
+
+
+/*
+* HasPortRead<T>::value is true if traits class T supplies readPort and friends.
+*/
+template<class T>
+struct HasPortRead {
+    template<class U> static char test(decltype(&U::readPort));
+    template<class U> static long test(...);
+    static const bool value = sizeof(test<T>(0)) == 1;
+};
+
+
+/*
+* HasWakeInterrupt<T>::value is true if traits class T supplies attachWakeInterrupt and friends.
+*/
+template<class T>
+struct HasWakeInterrupt {
+    template<class U> static char test(decltype(&U::attachWakeInterrupt));
+    template<class U> static long test(...);
+    static const bool value = sizeof(test<T>(0)) == 1;
+};
+
+
+/*
+* Adds send_report to a keyboard traits class Derived,
+* which supplies set_modifier, set_key1 to set_key6, and send_now.
+* Remembers the last report sent, and does not send the same one again,
+* so unlike other traits these are objects with state: copies do not share it.
+*/
+template<class Derived>
+class KeyboardReports {
+    keyboard_record last_sent;
+    bool has_sent;
+
+public:
+    KeyboardReports(): last_sent(), has_sent(false) {}
+
+    /**
+     * Set all of the report and send it, unless it is the same as the last one sent.
+     * Returns true if the report was actually sent.
+     */
+    bool send_report(const keyboard_record &record) {
+        if (has_sent && record == last_sent) {
+            return false;
+        }
+        Derived &self = static_cast<Derived &>(*this);
+        self.set_modifier(record.modifier_flags);
+        self.set_key1(record.keys[0]);
+        self.set_key2(record.keys[1]);
+        self.set_key3(record.keys[2]);
+        self.set_key4(record.keys[3]);
+        self.set_key5(record.keys[4]);
+        self.set_key6(record.keys[5]);
+        self.send_now();
+        last_sent = record;
+        has_sent = true;
+        return true;
+    }
 };
 
 
-struct KeyboardTraits {
+struct KeyboardTraits: KeyboardReports<KeyboardTraits> {
     /**
      * Set modifier keys. flags is combination of MODIFIERKEY_{CTRL,SHIFT,ALT,GUI}.
      */
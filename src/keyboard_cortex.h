@@ -6,49 +6,342 @@
 // #include "Keyboard.h"
 #include "hardware_traits.h"
 #include "keyboard_matrix.h"
+#include "keymap.h"
 
-const int usb_rollover_max = 6;
 
-struct keyboard_record {
-    modifier_flags_t modifier_flags;
-    std::array<scancode_t, usb_rollover_max> keys;
+/**
+ * Works out what to report to the host from the switches pressed.
+ *
+ * Record_t is keyboard_record for the standard 6-key report
+ * or nkro_record for N-key rollover.
+ * Keymap_t is a Keymap, or a SparseKeymap for keymaps whose upper layers are mostly transparent.
+ */
+template<int layer_count, int column_count, int row_count, class Record_t = keyboard_record,
+    class Keymap_t = ::Keymap<layer_count, column_count, row_count> >
+class KeyboardCortex {
+    static_assert(layer_count <= 32, "At most 32 layers supported");
 
-    keyboard_record():
-        modifier_flags(0), keys({})
-    {}
-    keyboard_record(modifier_flags_t modifier_flags, std::array<scancode_t, usb_rollover_max> initial_keys):
-        modifier_flags(modifier_flags), keys(initial_keys)
-    {}
-};
+public:
+    typedef Keymap_t Keymap;
 
+private:
+    // Switches are identified by cell number col * row_count + row.
+    static const int cell_count = column_count * row_count;
 
-template<int layer_count, int column_count, int row_count>
-class KeyboardCortex {
-    std::array<std::array<std::array<uint16_t, column_count>, row_count>, layer_count> layers;
+    // Key class of cache entries not worked out since the layers last changed.
+    static const uint8_t unresolved = 0xFF;
+
+    const Keymap *keymap;
+
+    // Layers: the default layer is always active, plus those with their bit set in layer_mask.
+    // Entries are taken from the highest active layer where they are not transparent.
+    uint32_t layer_mask;
+    uint8_t default_layer;
+    std::array<KeymapEntry, cell_count> resolved;  // What each switch means with the current layers.
+
+    // State for building the record incrementally from switch events.
+    Record_t record;
+    bool dirty;
+    std::array<KeymapEntry, cell_count> pressed_entries;  // What each switch meant when pressed.
+    std::array<uint8_t, 8> modifier_holds;  // How many switches are holding each modifier bit.
+    // Regular keys that did not go in to the record, as cells, in order pressed:
+    // it was full, or for nkro_record another switch already had the key down.
+    std::array<uint16_t, cell_count> overflowed;
+    int overflowed_count;
+    // Macros whose keys have been pressed, in order, until taken.
+    std::array<uint8_t, 4> started_macros;
+    int started_macro_count;
 
 public:
-    KeyboardCortex(std::array<std::array<std::array<uint16_t, column_count>, row_count>, layer_count> initial_layers):
-        layers(initial_layers)
-    {}
+    /**
+     * The keymap is not copied, so must outlive the cortex.
+     */
+    explicit KeyboardCortex(const Keymap &keymap_0):
+        keymap(&keymap_0), layer_mask(0), default_layer(0),
+        record(), dirty(false), pressed_entries(), modifier_holds(), overflowed(), overflowed_count(0),
+        started_macros(), started_macro_count(0)
+    {
+        invalidate_layers();
+    }
 
 public:
-    keyboard_record record_from_switches(const Switches &switches) const {
-        keyboard_record result;
-        int layer = 0;
-        int k = 0;
+    /**
+     * Build a record from scratch.
+     *
+     * Uses the current layers plus any momentary layers held among switches,
+     * including those only reached through other momentary layers held.
+     */
+    Record_t record_from_switches(const Switches &switches) {
+        uint32_t layers = active_layers();
+        for (uint32_t seen = 0; seen != layers; ) {
+            seen = layers;
+            for (Switch switch_ : switches) {
+                KeymapEntry entry = entry_for(switch_.col, switch_.row, seen);
+                if (entry.key_class == KEY_CLASS_LAYER && (entry.code & LAYER_ACTION_MASK) == LAYER_ACTION_MOMENTARY) {
+                    layers |= uint32_t(1) << (entry.code & LAYER_NUMBER_MASK);
+                }
+            }
+        }
+
+        Record_t result;
         for (Switch switch_ : switches) {
-            uint16_t code = layers[layer][switch_.row][switch_.col];
-            if ((code & 0xFF00) == 0xE000) {
-                // Modifer key.
-                result.modifier_flags |= code;
+            KeymapEntry entry = entry_for(switch_.col, switch_.row, layers);
+            switch (entry.key_class) {
+            case KEY_CLASS_MODIFIER:
+                result.modifier_flags |= 0xE000 | entry.code;
+                break;
+            case KEY_CLASS_REGULAR:
+                // Dropped if there is no room.
+                result.add_key(entry.code);
+                break;
+            default:
+                // Not part of a keyboard report.
+                break;
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Update the record for one press or release.
+     *
+     * Gives the same record as record_from_switches would for the switches
+     * pressed so far, in the order they were pressed.
+     */
+    void apply(const SwitchEvent &event) {
+        int cell = event.col * row_count + event.row;
+        // A switch is released with the meaning it was pressed with, whatever the layers are now.
+        apply(event, event.is_press ? lookup(cell) : pressed_entries[cell]);
+    }
+
+    /**
+     * Update the record for a press of a switch with the given meaning instead of the keymap's.
+     * Used by stages like TapHoldResolver that decide what a switch means.
+     * When the switch is released it uses the meaning it was pressed with.
+     */
+    void apply(const SwitchEvent &event, const KeymapEntry &press_entry) {
+        int cell = event.col * row_count + event.row;
+        if (event.is_press) {
+            pressed_entries[cell] = press_entry;
+        }
+        const KeymapEntry entry = pressed_entries[cell];
+        switch (entry.key_class) {
+        case KEY_CLASS_MODIFIER:
+            apply_modifier(entry.code, event.is_press);
+            break;
+        case KEY_CLASS_REGULAR:
+            if (event.is_press) {
+                press_key(cell, entry.code);
             } else {
-                // Regular key.
-                if (k < usb_rollover_max) {
-                    result.keys.at(k++) = code & 0xFF;
+                release_key(cell, entry.code);
+            }
+            break;
+        case KEY_CLASS_LAYER:
+            apply_layer_action(entry.code, event.is_press);
+            break;
+        case KEY_CLASS_MACRO:
+            if (event.is_press && started_macro_count < static_cast<int>(started_macros.size())) {
+                started_macros[started_macro_count++] = entry.code;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    /**
+     * Apply all the events waiting in the queue.
+     */
+    void apply(SwitchEvents &events) {
+        SwitchEvent event;
+        while (events.pop(event)) {
+            apply(event);
+        }
+    }
+
+    /**
+     * If the record has changed since last taken, copy it to result and return true.
+     * Otherwise there is no need to send a new report.
+     */
+    bool take_record(Record_t &result) {
+        if (!dirty) {
+            return false;
+        }
+        result = record;
+        dirty = false;
+        return true;
+    }
+
+    /**
+     * If a macro key has been pressed since last taken, copy its macro number to result and return true.
+     * Macros are taken in the order their keys were pressed.
+     * Presses while several are already waiting are dropped.
+     */
+    bool take_macro(uint8_t &result) {
+        if (!started_macro_count) {
+            return false;
+        }
+        result = started_macros[0];
+        for (int m = 1; m < started_macro_count; ++m) {
+            started_macros[m - 1] = started_macros[m];
+        }
+        --started_macro_count;
+        return true;
+    }
+
+    bool is_dirty() const {
+        return dirty;
+    }
+
+    const Record_t &current_record() const {
+        return record;
+    }
+
+    /**
+     * Bitmask of layers whose entries are used, including the default layer.
+     */
+    uint32_t active_layers() const {
+        return layer_mask | (uint32_t(1) << default_layer);
+    }
+
+    /**
+     * Makes layer the one used under all the others. Ignored if there is no such layer.
+     */
+    void set_default_layer(int layer) {
+        if (layer < 0 || layer >= layer_count) {
+            return;
+        }
+        if (layer != default_layer) {
+            default_layer = layer;
+            invalidate_layers();
+        }
+    }
+
+    /**
+     * What the switch means with the current layers.
+     *
+     * Worked out at most once per switch after each change of layers,
+     * so usually a single load however many layers there are.
+     */
+    const KeymapEntry &lookup(int col, int row) {
+        return lookup(col * row_count + row);
+    }
+
+private:
+    const KeymapEntry &lookup(int cell) {
+        KeymapEntry &entry = resolved[cell];
+        if (entry.key_class == unresolved) {
+            entry = resolve(cell / row_count, cell % row_count, active_layers());
+        }
+        return entry;
+    }
+
+    // What the switch means with these layers, from the cache if they are the current ones.
+    KeymapEntry entry_for(int col, int row, uint32_t layers) {
+        return layers == active_layers() ? lookup(col * row_count + row) : resolve(col, row, layers);
+    }
+
+    KeymapEntry resolve(int col, int row, uint32_t layers) const {
+        for (int layer = layer_count - 1; layer >= 0; --layer) {
+            if ((layers >> layer) & 1) {
+                KeymapEntry entry = keymap_entry(*keymap, layer, col, row);
+                if (entry.key_class != KEY_CLASS_TRANSPARENT) {
+                    return entry;
                 }
             }
         }
-        return result;
+        return KeymapEntry();
+    }
+
+    void invalidate_layers() {
+        KeymapEntry entry;
+        entry.key_class = unresolved;
+        resolved.fill(entry);
+    }
+
+    void set_layer_mask(uint32_t next_layer_mask) {
+        if (next_layer_mask != layer_mask) {
+            layer_mask = next_layer_mask;
+            invalidate_layers();
+        }
+    }
+
+    void apply_layer_action(uint8_t code, bool is_press) {
+        int layer = code & LAYER_NUMBER_MASK;
+        if (layer >= layer_count) {
+            return;
+        }
+        uint32_t bit = uint32_t(1) << layer;
+        switch (code & LAYER_ACTION_MASK) {
+        case LAYER_ACTION_MOMENTARY:
+            set_layer_mask(is_press ? layer_mask | bit : layer_mask & ~bit);
+            break;
+        case LAYER_ACTION_TOGGLE:
+            if (is_press) {
+                set_layer_mask(layer_mask ^ bit);
+            }
+            break;
+        case LAYER_ACTION_DEFAULT:
+            if (is_press) {
+                set_default_layer(layer);
+            }
+            break;
+        }
+    }
+
+    void apply_modifier(uint8_t bits, bool is_press) {
+        modifier_flags_t flags = 0;
+        for (int b = 0; b < 8; ++b) {
+            if (bits & (1 << b)) {
+                if (is_press) {
+                    ++modifier_holds[b];
+                } else if (modifier_holds[b]) {
+                    --modifier_holds[b];
+                }
+            }
+            if (modifier_holds[b]) {
+                flags |= 0xE000 | (1 << b);
+            }
+        }
+        if (flags != record.modifier_flags) {
+            record.modifier_flags = flags;
+            dirty = true;
+        }
+    }
+
+    void press_key(uint16_t cell, scancode_t scancode) {
+        if (record.add_key(scancode)) {
+            dirty = true;
+        } else {
+            overflowed[overflowed_count++] = cell;
+        }
+    }
+
+    void release_key(uint16_t cell, scancode_t scancode) {
+        // It may never have made it in to the record.
+        for (int m = 0; m < overflowed_count; ++m) {
+            if (overflowed[m] == cell) {
+                for (--overflowed_count; m < overflowed_count; ++m) {
+                    overflowed[m] = overflowed[m + 1];
+                }
+                return;
+            }
+        }
+
+        if (!record.remove_key(scancode)) {
+            return;
+        }
+        dirty = true;
+
+        // Use the room for the earliest key that now goes in.
+        for (int m = 0; m < overflowed_count; ++m) {
+            if (record.add_key(pressed_entries[overflowed[m]].code)) {
+                for (--overflowed_count; m < overflowed_count; ++m) {
+                    overflowed[m] = overflowed[m + 1];
+                }
+                return;
+            }
+        }
     }
 };
 
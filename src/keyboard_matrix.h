@@ -8,14 +8,13 @@
 #include <iostream>
 #include <array>
 #include <stdexcept>
+#include <type_traits>
 #include "Arduino.h"
 #include "hardware_traits.h"
-
-
-/**
- * How long to ignore changes after switch changes state.
- */
-const millis_t debounce_millis = 50;
+#include "debounce.h"
+#include "ghost_filter.h"
+#include "spsc_ring.h"
+#include "scan_stats.h"
 
 
 /**
@@ -37,6 +36,54 @@ struct Switch {
     }
 };
 
+/**
+ * A switch being pressed or released, as published by KeyboardMatrix.
+ */
+struct SwitchEvent {
+    char col;
+    char row;
+    bool is_press;
+    millis_t millis;  // When the change was recorded.
+
+    SwitchEvent(int col_0, int row_0, bool is_press_0, millis_t millis_0):
+        col(col_0), row(row_0), is_press(is_press_0), millis(millis_0) {}
+    SwitchEvent(): SwitchEvent(0, 0, false, 0) {}
+
+    bool operator==(const SwitchEvent &other) const {
+        return col == other.col && row == other.row && is_press == other.is_press && millis == other.millis;
+    }
+};
+
+/**
+ * How many events KeyboardMatrix can hold for its consumer.
+ */
+const int switch_event_capacity = 32;
+
+typedef SpscRing<SwitchEvent, switch_event_capacity> SwitchEvents;
+
+
+/**
+ * How often KeyboardMatrix scans.
+ *
+ * While any switch reads closed or is reported pressed, which covers every switch
+ * still being debounced, it scans every active_period milliseconds.
+ * Once nothing has happened for idle_millis the period doubles, and doubles again
+ * after each further idle_millis, up to slowest_period.
+ * The first switch seen closed brings it straight back to active_period.
+ *
+ * Only full scans are spaced out. While idle, KeyboardMatrix::loop reads the rows on every
+ * call, or on a wake interrupt, so the first press is not delayed by the period.
+ */
+struct ScanRate {
+    millis_t active_period;
+    millis_t slowest_period;
+    millis_t idle_millis;
+
+    ScanRate(millis_t active_period_0 = 1, millis_t slowest_period_0 = 8, millis_t idle_millis_0 = 1000):
+        active_period(active_period_0), slowest_period(slowest_period_0), idle_millis(idle_millis_0) {}
+};
+
+
 class Switches {
     const Switch *ptr;
     size_t extent;
@@ -71,71 +118,253 @@ public:
 };
 
 
+/**
+ * Smallest unsigned type with at least bit_count bits.
+ * Used for bitmasks so that a whole column of switches is updated in one operation.
+ */
+template<int bit_count>
+struct BitsFor {
+    static_assert(bit_count > 0 && bit_count <= 32, "Between 1 and 32 bits supported");
+    typedef typename std::conditional<bit_count <= 8, uint8_t,
+        typename std::conditional<bit_count <= 16, uint16_t, uint32_t>::type>::type type;
+};
+
+
+/**
+ * Reads the row pins as a bitmask, with bit j set if row j is LOW.
+ * This version reads them one pin at a time.
+ */
+template<int row_count, typename Pin_t, class Traits_t, bool use_ports = HasPortRead<Traits_t>::value>
+class RowReader {
+public:
+    typedef typename BitsFor<row_count>::type row_bits_t;
+
+    explicit RowReader(const std::array<const Pin_t, row_count> &) {}
+
+    row_bits_t read(const std::array<const Pin_t, row_count> &row_pins) const {
+        row_bits_t result = 0;
+        for (int j = 0; j < row_count; ++j) {
+            if (Traits_t::digitalRead(row_pins[j]) == LOW) {
+                result |= row_bits_t(1) << j;
+            }
+        }
+        return result;
+    }
+};
+
+/**
+ * This version is used when the traits can read a whole port.
+ * If the rows are all on the same port they are read with a single read of the port;
+ * otherwise it falls back to reading one pin at a time.
+ */
+template<int row_count, typename Pin_t, class Traits_t>
+class RowReader<row_count, Pin_t, Traits_t, true> {
+public:
+    typedef typename BitsFor<row_count>::type row_bits_t;
+
+private:
+    typedef typename Traits_t::port_t port_t;
+    typedef typename Traits_t::port_bits_t port_bits_t;
+
+    port_t port;  // port_t() if rows are not all on one port.
+    std::array<port_bits_t, row_count> masks;
+    int shift;  // If rows are consecutive bits of the port, the bit for row 0; otherwise -1.
+
+public:
+    explicit RowReader(const std::array<const Pin_t, row_count> &row_pins):
+        port(Traits_t::digitalPinPort(row_pins[0])), shift(-1)
+    {
+        for (int j = 0; j < row_count; ++j) {
+            masks[j] = Traits_t::digitalPinBitMask(row_pins[j]);
+            if (Traits_t::digitalPinPort(row_pins[j]) != port || !masks[j]) {
+                port = port_t();
+            }
+        }
+        if (port == port_t()) {
+            return;
+        }
+        int first = 0;
+        while (!((masks[0] >> first) & 1)) {
+            ++first;
+        }
+        shift = first;
+        for (int j = 0; j < row_count; ++j) {
+            if (masks[j] != port_bits_t(masks[0] << j)) {
+                shift = -1;
+            }
+        }
+    }
+
+    row_bits_t read(const std::array<const Pin_t, row_count> &row_pins) const {
+        if (port == port_t()) {
+            return RowReader<row_count, Pin_t, Traits_t, false>(row_pins).read(row_pins);
+        }
+        port_bits_t value = Traits_t::readPort(port);
+        if (shift >= 0) {
+            return row_bits_t(~(value >> shift)) & all_rows();
+        }
+        row_bits_t result = 0;
+        for (int j = 0; j < row_count; ++j) {
+            if (!(value & masks[j])) {
+                result |= row_bits_t(1) << j;
+            }
+        }
+        return result;
+    }
+
+private:
+    static row_bits_t all_rows() {
+        return row_bits_t(~row_bits_t(0)) >> (8 * sizeof(row_bits_t) - row_count);
+    }
+};
+
+
 /**
  * Thing that probes the matrix and records which switches are pressed.
+ *
+ * Each press and release can also be published, in the order they happened,
+ * to a ring given to publish_events. Nothing is published until then.
+ *
+ * Instrument_t is NoScanInstrumentation, which costs nothing,
+ * or a ScanInstrumentation to measure scans.
+ *
+ * Ghost_t is NoGhostFilter when every switch has a diode,
+ * or RectangleGhostFilter to hold back phantom presses when they do not.
  */
-template<int column_count, int row_count, typename Pin_t = int, class Traits_t = PinTraits>
-class KeyboardMatrix {
+template<int column_count, int row_count, typename Pin_t = int, class Traits_t = PinTraits, class Debounce_t = LockoutDebounce<>,
+    class Instrument_t = NoScanInstrumentation, class Ghost_t = NoGhostFilter>
+class KeyboardMatrix: private Instrument_t {
+public:
+    typedef typename BitsFor<row_count>::type row_bits_t;
+
+private:
     std::array<const Pin_t, column_count> column_pins;
     std::array<const Pin_t, row_count> row_pins;
+    RowReader<row_count, Pin_t, Traits_t> row_reader;
+
+    // State is one bitmask of rows per column: bit j of pressed_rows[i] is set if switch (i, j) is pressed.
+    std::array<row_bits_t, column_count> pressed_rows;
+    typename Debounce_t::template Debouncer<column_count, row_count, row_bits_t> debouncer;
+    typename Ghost_t::template Filter<column_count, row_bits_t> ghost_filter;
 
-    // We record the pressed switches and switches that have been recently released.
-    // They share a fixed-size array to avoid dynamic allocation.
-    //    switches[0:pressed_count] are pressed switches.
-    //    switches[pressed_count:(pressed_count + released_count)] are switches released within debounce_millis.
+    // The pressed switches again, in the order they were pressed, so they can be returned as Switches.
+    // Only touched when a switch changes state.
     std::array<Switch, column_count * row_count> switches;
     int pressed_count;
-    int released_count;
+
+    // Each change is also published here, if anywhere.
+    SwitchEvents *switch_events;
+
+    // Set when a scan finds nothing closed and nothing pressed. All columns are then held LOW,
+    // so any switch closing pulls its row LOW, and each loop only reads the rows until one does.
+    bool idle;
+    row_bits_t closed_seen;  // Rows read as closed in any column during the current scan.
+
+    ScanRate rate;
+    millis_t period;  // Current time between scans.
+    millis_t next_millis;  // When the next scan is due.
+    millis_t quiet_from;  // When the period was last changed, or something last happened.
+    bool started;  // Whether next_millis has been set from the time.
 
 public:
     KeyboardMatrix(std::array<const Pin_t, column_count> &&column_pins_0, std::array<const Pin_t, row_count> &&row_pins_0):
-        column_pins(column_pins_0), row_pins(row_pins_0), pressed_count(0), released_count(0)
+        column_pins(column_pins_0), row_pins(row_pins_0), row_reader(row_pins), pressed_rows(), debouncer(), ghost_filter(), pressed_count(0), switch_events(nullptr), idle(false), closed_seen(0),
+        rate(), period(rate.active_period), next_millis(0), quiet_from(0), started(false)
     {
         set_up();
     }
 
     KeyboardMatrix(const std::array<const Pin_t, column_count> &column_pins_0, const std::array<const Pin_t, row_count> &row_pins_0):
-        column_pins(column_pins_0), row_pins(row_pins_0)
+        column_pins(column_pins_0), row_pins(row_pins_0), row_reader(row_pins), pressed_rows(), debouncer(), ghost_filter(), pressed_count(0), switch_events(nullptr), idle(false), closed_seen(0),
+        rate(), period(rate.active_period), next_millis(0), quiet_from(0), started(false)
+    {
+        set_up();
+    }
+
+    /**
+     * Used when Traits_t is a StaticMatrixPinTraits, which knows the pins already.
+     */
+    KeyboardMatrix():
+        column_pins{}, row_pins{}, row_reader(row_pins), pressed_rows(), debouncer(), ghost_filter(), pressed_count(0), switch_events(nullptr), idle(false), closed_seen(0),
+        rate(), period(rate.active_period), next_millis(0), quiet_from(0), started(false)
     {
+        static_assert(HasStaticPins<Traits_t>::value, "Pins must be supplied unless the traits fix them");
         set_up();
     }
 
-    KeyboardMatrix(KeyboardMatrix &&other): column_pins(other.column_pins), row_pins(other.row_pins) {}
+    KeyboardMatrix(KeyboardMatrix &&other):
+        Instrument_t(other), column_pins(other.column_pins), row_pins(other.row_pins), row_reader(other.row_reader),
+        pressed_rows(other.pressed_rows), debouncer(other.debouncer), ghost_filter(other.ghost_filter),
+        switches(other.switches), pressed_count(other.pressed_count), switch_events(other.switch_events), idle(other.idle), closed_seen(other.closed_seen),
+        rate(other.rate), period(other.period), next_millis(other.next_millis), quiet_from(other.quiet_from), started(other.started)
+    {}
 
     /**
      * Called repeatedly in Arduino's loop.
+     *
+     * Does nothing until the next scan is due, as set by the ScanRate.
+     * When nothing is changing a scan costs one mask comparison per column on top of reading the pins.
+     * When nothing is pressed either the matrix is idle, and every call, due or not,
+     * costs one read of the rows, so the first press after a quiet spell is seen at once.
+     * So call it every time round Arduino's loop, not just at next_scan_millis.
+     *
+     * Returns true if it scanned the matrix, rather than doing nothing or only reading the rows.
      */
-    void loop(millis_t millis) {
-        // Discard expired key-released records.
-        int prev = pressed_count;
-        for (int k = pressed_count; k < pressed_count + released_count; ++k) {
-            if (millis - switches[k].millis >= debounce_millis) {
-                // Discard this record.
-            } else {
-                if (prev != k) {
-                    // We are shifting keys down to remove the gaps left by replaced ones.
-                    std::swap(switches[prev], switches[k]);
+    bool loop(millis_t millis) {
+        if (!started) {
+            started = true;
+            next_millis = millis;
+            quiet_from = millis;
+        }
+        bool is_due = static_cast<long>(millis - next_millis) >= 0;
+        if (idle) {
+            // Read whether or not a wake interrupt fired, as a switch that closed
+            // before it was attached raises none.
+            if (!wake()) {
+                if (is_due) {
+                    // Nothing closed, so the next read can be later still.
+                    schedule_next_scan(millis);
                 }
-                ++prev;
+                return false;
             }
+        } else if (!is_due) {
+            return false;
         }
-        released_count = prev - pressed_count;
+        closed_seen = 0;
+        scan(millis, WholeScan());
+        if (!closed_seen && !pressed_count) {
+            // Nothing for the debouncer to remember, so it misses nothing while idle.
+            go_idle();
+        }
+        schedule_next_scan(millis);
+        return true;
+    }
 
-        // Scan the matrix.
-        for (int i = 0; i < column_count; ++i) {
-            Traits_t::pinMode(column_pins[i], OUTPUT);
-            Traits_t::digitalWrite(column_pins[i], LOW);
+    /**
+     * When loop next needs calling, for a scheduler or a sketch that sleeps in between.
+     * While scanning this is when the next scan is due. While idle it is when the rows
+     * should next be read, which backs off as set by the ScanRate without scanning:
+     * a loop then only scans if the rows show a switch closed, whenever it is called.
+     */
+    millis_t next_scan_millis() const {
+        return next_millis;
+    }
 
-            for (int j = 0; j < row_count; ++j) {
-                if (Traits_t::digitalRead(row_pins[j]) == LOW) {
-                    record_pressed(i, j, millis);
-                } else {
-                    record_unpressed(i, j, millis);
-                }
-            }
+    /**
+     * Change how often to scan. Takes effect from the next scan.
+     */
+    void set_scan_rate(const ScanRate &next_rate) {
+        rate = next_rate;
+        period = rate.active_period;
+    }
 
-            Traits_t::pinMode(column_pins[i], INPUT);  // Restore pin to floating state.
-        }
+    /**
+     * Whether the matrix is idle, holding all the columns LOW and waiting for a row to go LOW.
+     * If the traits supply attachWakeInterrupt, as WakePinTraits do, the row pins have interrupts
+     * attached while idle, so a sketch can sleep until a switch closes.
+     */
+    bool is_idle() const {
+        return idle;
     }
 
     /**
@@ -145,8 +374,57 @@ public:
         return Switches(&switches[0], pressed_count);
     }
 
+    /**
+     * From now on push each press and release to events, or stop with nullptr.
+     * The ring is not copied, so must outlive the matrix or be replaced first.
+     *
+     * It is a single-producer, single-consumer queue, so loop may be called from
+     * a timer interrupt while events are popped in Arduino's loop.
+     * Events are dropped (and counted) if the consumer falls too far behind,
+     * so pop all of them every time round.
+     */
+    void publish_events(SwitchEvents *events) {
+        switch_events = events;
+    }
+
+    /**
+     * Return bitmask of rows pressed in this column.
+     */
+    row_bits_t pressed_rows_in_column(int col) const {
+        return pressed_rows[col];
+    }
+
+    /**
+     * Measurements of scans so far, if Instrument_t takes any.
+     */
+    Instrument_t &instrumentation() {
+        return *this;
+    }
+
+    const Instrument_t &instrumentation() const {
+        return *this;
+    }
+
 private:
+    // Tag used to select the code for pins fixed at compile time.
+    typedef std::integral_constant<bool, HasStaticPins<Traits_t>::value> StaticPins;
+
+    // Tag used to select the code for traits that can raise an interrupt when a row goes LOW.
+    typedef std::integral_constant<bool, HasWakeInterrupt<Traits_t>::value> WakeInterrupt;
+
+    // Tag used to select the code for filters that need every column read before debouncing.
+    typedef std::integral_constant<bool, Ghost_t::template Filter<column_count, row_bits_t>::needs_whole_scan> WholeScan;
+
+    typedef typename Instrument_t::mark_t mark_t;
+
+    template<int i>
+    struct Column {};
+
     void set_up() {
+        set_up(StaticPins());
+    }
+
+    void set_up(std::false_type) {
         // Start with all column pins FLOATING.
         for (int i = 0; i < column_count; ++i) {
             Traits_t::pinMode(column_pins[i], INPUT);
@@ -157,35 +435,180 @@ private:
         }
     }
 
-    void record_pressed(int col, int row, millis_t millis) {
-        // See if already recoreded as pressed, or released within debounce time.
-        for (int k = 0; k < pressed_count + released_count; ++k) {
-            if (switches[k].col == col && switches[k].row == row) {
-                return;  // Already recorded: nothing to do.
+    void set_up(std::true_type) {
+        Traits_t::set_up();
+    }
+
+    void schedule_next_scan(millis_t millis) {
+        if (!idle) {
+            // Something is closed or pressed.
+            period = rate.active_period;
+            quiet_from = millis;
+        } else if (period < rate.slowest_period && millis - quiet_from >= rate.idle_millis) {
+            period = period ? 2 * period : 1;
+            if (period > rate.slowest_period) {
+                period = rate.slowest_period;
             }
+            quiet_from = millis;
         }
-        if (released_count > 0) {
-            // Make room!
-            std::swap(switches[pressed_count], switches[pressed_count + released_count]);
+        next_millis = millis + period;
+    }
+
+    void go_idle() {
+        write_all_columns(LOW, StaticPins());
+        set_wake_interrupts(true, WakeInterrupt());
+        idle = true;
+    }
+
+    // Returns true, and resumes scanning, if a switch has closed.
+    bool wake() {
+        if (!read_all_rows(StaticPins())) {
+            return false;
         }
-        switches[pressed_count++] = Switch(col, row, millis);
+        set_wake_interrupts(false, WakeInterrupt());
+        write_all_columns(HIGH, StaticPins());
+        idle = false;
+        return true;
     }
 
-    void record_unpressed(int col, int row, millis_t millis) {
-        for (int k = 0; k < pressed_count; ++k) {
-            if (switches[k].col == col && switches[k].row == row) {
-                if (millis - switches[k].millis >= debounce_millis) {
-                    // Swap this switch to the start of the released list.
-                    if (k != pressed_count - 1) {
-                        std::swap(switches[k], switches[pressed_count - 1]);
-                    }
-                    switches[--pressed_count].millis = millis;
-                    ++released_count;
-                }
-                return;
+    // Writing HIGH lets the columns float again.
+    void write_all_columns(int value, std::false_type) {
+        for (int i = 0; i < column_count; ++i) {
+            if (value == LOW) {
+                Traits_t::pinMode(column_pins[i], OUTPUT);
+                Traits_t::digitalWrite(column_pins[i], LOW);
+            } else {
+                Traits_t::pinMode(column_pins[i], INPUT);
             }
         }
-        // Not found, so nothing to do.
+    }
+
+    void write_all_columns(int value, std::true_type) {
+        Traits_t::write_all_columns(value);
+    }
+
+    row_bits_t read_all_rows(std::false_type) const {
+        return row_reader.read(row_pins);
+    }
+
+    row_bits_t read_all_rows(std::true_type) const {
+        return Traits_t::template read_all_rows<row_bits_t>();
+    }
+
+    void set_wake_interrupts(bool is_attached, std::true_type) {
+        for (int j = 0; j < row_count; ++j) {
+            if (is_attached) {
+                Traits_t::attachWakeInterrupt(row_pins[j]);
+            } else {
+                Traits_t::detachWakeInterrupt(row_pins[j]);
+            }
+        }
+    }
+
+    void set_wake_interrupts(bool, std::false_type) {}
+
+    // Each column is debounced as soon as it has been read.
+    void scan(millis_t millis, std::false_type) {
+        read_columns(Instrument_t::begin_scan(), [this, millis](int col, row_bits_t sampled, mark_t mark) -> mark_t {
+            return update_column(col, sampled, millis, mark);
+        }, StaticPins());
+        Instrument_t::end_scan(pressed_count);
+    }
+
+    void scan(millis_t millis, std::true_type) {
+        std::array<row_bits_t, column_count> sampled;
+        mark_t mark = read_columns(Instrument_t::begin_scan(), [&sampled](int col, row_bits_t rows, mark_t mark) -> mark_t {
+            sampled[col] = rows;
+            return mark;
+        }, StaticPins());
+        ghost_filter.filter(sampled, pressed_rows);
+        mark = Instrument_t::end_phase(SCAN_PHASE_GHOST_FILTER, mark);
+        for (int i = 0; i < column_count; ++i) {
+            mark = update_column(i, sampled[i], millis, mark);
+        }
+        Instrument_t::end_scan(pressed_count);
+    }
+
+    // Strobe each column in turn and pass what was read to column_read.
+    template<class Read_t>
+    mark_t read_columns(mark_t mark, Read_t column_read, std::false_type) {
+        for (int i = 0; i < column_count; ++i) {
+            Traits_t::pinMode(column_pins[i], OUTPUT);
+            Traits_t::digitalWrite(column_pins[i], LOW);
+            mark = Instrument_t::end_phase(SCAN_PHASE_STROBE, mark);
+
+            row_bits_t sampled = row_reader.read(row_pins);
+            mark = Instrument_t::end_phase(SCAN_PHASE_READ, mark);
+
+            Traits_t::pinMode(column_pins[i], INPUT);  // Restore pin to floating state.
+            mark = Instrument_t::end_phase(SCAN_PHASE_STROBE, mark);
+
+            closed_seen |= sampled;
+            mark = column_read(i, sampled, mark);
+        }
+        return mark;
+    }
+
+    // With pins fixed at compile time the loop over columns is unrolled
+    // so that each strobe uses constant pin numbers.
+    template<class Read_t>
+    mark_t read_columns(mark_t mark, Read_t column_read, std::true_type) {
+        return read_columns(mark, column_read, Column<0>());
+    }
+
+    template<class Read_t>
+    mark_t read_columns(mark_t mark, Read_t, Column<column_count>) {
+        return mark;
+    }
+
+    template<class Read_t, int i>
+    mark_t read_columns(mark_t mark, Read_t column_read, Column<i>) {
+        row_bits_t sampled = Traits_t::template read_column<i, row_bits_t>();
+        mark = Instrument_t::end_phase(SCAN_PHASE_READ, mark);
+        closed_seen |= sampled;
+        return read_columns(column_read(i, sampled, mark), column_read, Column<i + 1>());
+    }
+
+    mark_t update_column(int col, row_bits_t sampled, millis_t millis, mark_t mark) {
+        row_bits_t changed = debouncer.update(col, sampled, pressed_rows[col], millis) ^ pressed_rows[col];
+        mark = Instrument_t::end_phase(SCAN_PHASE_DEBOUNCE, mark);
+        Instrument_t::column_updated(row_bits_t(sampled ^ pressed_rows[col]), changed);
+        if (changed) {
+            record_changes(col, changed, millis);
+            mark = Instrument_t::end_phase(SCAN_PHASE_RECORD, mark);
+        }
+        return mark;
+    }
+
+    // Flip the state of switches whose bits are set in changed.
+    void record_changes(int col, row_bits_t changed, millis_t millis) {
+        for (int j = 0; changed; ++j, changed >>= 1) {
+            if (!(changed & 1)) {
+                continue;
+            }
+            row_bits_t bit = row_bits_t(1) << j;
+            pressed_rows[col] ^= bit;
+            bool is_press = pressed_rows[col] & bit;
+            if (is_press) {
+                switches[pressed_count++] = Switch(col, j, millis);
+            } else {
+                remove_switch(Switch(col, j));
+            }
+            if (switch_events) {
+                switch_events->push(SwitchEvent(col, j, is_press, millis));
+            }
+        }
+    }
+
+    void remove_switch(Switch switch_) {
+        int k = 0;
+        while (k < pressed_count && switches[k] != switch_) {
+            ++k;
+        }
+        // Close the gap, keeping the remaining switches in the order pressed.
+        for (--pressed_count; k < pressed_count; ++k) {
+            switches[k] = switches[k + 1];
+        }
     }
 };
 
@@ -0,0 +1,5 @@
+/**
+ * Implementation of keymaps.
+ */
+
+#include "keymap.h"
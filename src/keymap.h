@@ -0,0 +1,210 @@
+/**
+ * Keymaps: what code each switch produces on each layer.
+ */
+
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <array>
+#include <stdexcept>
+#include "hardware_traits.h"
+
+
+/**
+ * What kind of thing a keymap entry does, worked out when the keymap is compiled.
+ */
+enum KeyClass {
+    KEY_CLASS_NONE,
+    KEY_CLASS_REGULAR,   // code is a scancode.
+    KEY_CLASS_MODIFIER,  // code is modifier bits.
+    KEY_CLASS_MEDIA,     // code is a consumer-control usage.
+    KEY_CLASS_SYSTEM,    // code is a system-control usage.
+    KEY_CLASS_LAYER,     // code is a layer action.
+    KEY_CLASS_TRANSPARENT,  // Use the entry from the next active layer down.
+    KEY_CLASS_MACRO,     // code is a macro number.
+};
+
+/*
+* Codes with this in the upper 8 bits are layer actions.
+* The lower 8 bits are one of the LAYER_ACTION_* values plus a layer number.
+*/
+#define KEY_LAYER_ACTION 0xE800
+
+#define LAYER_ACTION_MOMENTARY  0x00  // Layer is active while key is held.
+#define LAYER_ACTION_TOGGLE     0x20  // Pressing key toggles layer on and off.
+#define LAYER_ACTION_DEFAULT    0x40  // Pressing key makes layer the base layer.
+#define LAYER_ACTION_MASK       0xE0
+#define LAYER_NUMBER_MASK       0x1F
+
+#define LAYER_MOMENTARY(layer)  ( KEY_LAYER_ACTION | LAYER_ACTION_MOMENTARY | (layer) )
+#define LAYER_TOGGLE(layer)     ( KEY_LAYER_ACTION | LAYER_ACTION_TOGGLE | (layer) )
+#define LAYER_DEFAULT(layer)    ( KEY_LAYER_ACTION | LAYER_ACTION_DEFAULT | (layer) )
+#define KEY_TRANSPARENT         ( KEY_LAYER_ACTION | 0xFF )
+
+/*
+* Codes with this in the upper 8 bits play a macro when pressed.
+* The lower 8 bits are the macro's number.
+*/
+#define KEY_MACRO 0xEA00
+
+#define MACRO_KEY(number)       ( KEY_MACRO | (number) )
+
+/*
+* Range of scancodes for regular keys (KEY_A to KEY_F24).
+*/
+const uint8_t min_regular_scancode = 0x04;
+const uint8_t max_regular_scancode = 0x73;
+static_assert(max_regular_scancode < nkro_scancode_count, "Every regular key must have a bit in nkro_record");
+
+
+/**
+ * One entry in a keymap.
+ *
+ * Created from one of the 16-bit codes in Keyboard.h, like KEY_A or MODIFIERKEY_SHIFT.
+ * The constructor is constexpr, so a keymap declared constexpr is classified
+ * by the compiler and any code that is out of range is a compile-time error.
+ * (At run time it throws std::out_of_range instead.)
+ */
+struct KeymapEntry {
+    uint8_t key_class;
+    uint8_t code;
+
+    constexpr KeymapEntry(): key_class(KEY_CLASS_NONE), code(0) {}
+
+    constexpr KeymapEntry(uint16_t code_0):
+        key_class(classify(code_0)), code(code_0 & 0xFF) {}
+
+    constexpr bool operator==(const KeymapEntry &other) const {
+        return key_class == other.key_class && code == other.code;
+    }
+
+    static constexpr uint8_t classify(uint16_t code) {
+        return code == 0 ? KEY_CLASS_NONE
+            : (code & 0xFF00) == 0xE000 ? KEY_CLASS_MODIFIER
+            : (code & 0xFF00) == 0xE200 ? KEY_CLASS_SYSTEM
+            : (code & 0xFF00) == 0xE400 ? KEY_CLASS_MEDIA
+            : code == KEY_TRANSPARENT ? KEY_CLASS_TRANSPARENT
+            : (code & 0xFF00) == KEY_LAYER_ACTION && (code & LAYER_ACTION_MASK) <= LAYER_ACTION_DEFAULT ? KEY_CLASS_LAYER
+            : (code & 0xFF00) == KEY_MACRO ? KEY_CLASS_MACRO
+            : (code & 0xFF00) == 0xF000 && (code & 0xFF) >= min_regular_scancode && (code & 0xFF) <= max_regular_scancode
+                ? KEY_CLASS_REGULAR
+            : throw std::out_of_range("Not a key code");
+    }
+};
+
+
+/**
+ * Keymap for layer_count layers of row_count by column_count switches.
+ *
+ * Declare keymaps constexpr at namespace scope and pass them to KeyboardCortex by reference.
+ * That way they are not copied, and on ARM-based Teensy boards they stay in flash, not RAM.
+ */
+template<int layer_count, int column_count, int row_count>
+using Keymap = std::array<std::array<std::array<KeymapEntry, column_count>, row_count>, layer_count>;
+
+template<size_t layer_count, size_t column_count, size_t row_count>
+KeymapEntry keymap_entry(const std::array<std::array<std::array<KeymapEntry, column_count>, row_count>, layer_count> &keymap,
+    int layer, int col, int row) {
+    return keymap[layer][row][col];
+}
+
+
+/**
+ * An entry on an upper layer of a SparseKeymap.
+ * cell is col * row_count + row.
+ */
+struct KeymapOverride {
+    uint8_t cell;
+    KeymapEntry entry;
+};
+
+
+/**
+ * The entries of an upper layer of a SparseKeymap that are not transparent,
+ * in order of cell, and found by binary search.
+ *
+ * Made from an array of overrides declared constexpr at namespace scope, which is not copied.
+ * Overrides out of order are a compile-time error in a constexpr keymap,
+ * and throw std::invalid_argument at run time.
+ */
+class KeymapOverlay {
+    const KeymapOverride *overrides;
+    int count;
+
+public:
+    // A layer that is all transparent.
+    constexpr KeymapOverlay(): overrides(nullptr), count(0) {}
+
+    template<size_t count_0>
+    constexpr KeymapOverlay(const KeymapOverride (&overrides_0)[count_0]):
+        overrides(overrides_0),
+        count(is_in_order(overrides_0, count_0) ? count_0 : throw std::invalid_argument("Overrides must be in order of cell"))
+    {}
+
+    /**
+     * The entry for the cell, which is transparent if it is not overridden.
+     */
+    KeymapEntry find(int cell) const {
+        int low = 0;
+        int high = count;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (overrides[middle].cell < cell) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low < count && overrides[low].cell == cell ? overrides[low].entry : KeymapEntry(KEY_TRANSPARENT);
+    }
+
+    int size() const {
+        return count;
+    }
+
+private:
+    static constexpr bool is_in_order(const KeymapOverride *first, size_t count) {
+        return count < 2 || (first[0].cell < first[1].cell && is_in_order(first + 1, count - 1));
+    }
+};
+
+
+/**
+ * Keymap for boards whose upper layers are mostly transparent.
+ * The base layer is stored in full, so looking up an entry on it is a single load.
+ * Each upper layer only stores its overrides, at 3 bytes each,
+ * and looking one up takes a binary search.
+ * On Teensy a 10-layer keymap for 6 rows of 18 takes 216 bytes for the base layer
+ * and 8 bytes for each other layer plus its overrides, instead of 2160 bytes.
+ *
+ * Declare it constexpr at namespace scope, as for Keymap:
+ *
+ *   constexpr KeymapOverride fn_layer[] = { {4, KEY_F1}, {7, KEY_F2} };
+ *   constexpr SparseKeymap<2, 4, 3> keymap = {
+ *       {{ ... rows of the base layer ... }},
+ *       {{ KeymapOverlay(fn_layer) }},
+ *   };
+ */
+template<int layer_count, int column_count, int row_count>
+struct SparseKeymap {
+    static_assert(column_count * row_count <= 256, "Cells must fit in a byte");
+
+    std::array<std::array<KeymapEntry, column_count>, row_count> base;
+    std::array<KeymapOverlay, layer_count - 1> overlays;
+
+    static constexpr uint8_t cell(int col, int row) {
+        return col * row_count + row;
+    }
+
+    KeymapEntry entry(int layer, int col, int row) const {
+        return layer == 0 ? base[row][col] : overlays[layer - 1].find(cell(col, row));
+    }
+};
+
+template<int layer_count, int column_count, int row_count>
+KeymapEntry keymap_entry(const SparseKeymap<layer_count, column_count, row_count> &keymap, int layer, int col, int row) {
+    return keymap.entry(layer, col, row);
+}
+
+
+#endif // KEYMAP_H
@@ -0,0 +1,5 @@
+/**
+ * Implementation of macros.
+ */
+
+#include "macro.h"
@@ -0,0 +1,184 @@
+/**
+ * Macros: keys that type out a sequence of reports, such as shortcuts or boilerplate text.
+ *
+ * A macro is a string of bytes ending with MACRO_END, written with the MACRO_* macros:
+ *
+ *   constexpr uint8_t sign_off[] = {
+ *       MACRO_MODIFIERS(MODIFIERKEY_SHIFT), MACRO_TAP(KEY_T), MACRO_MODIFIERS(0),
+ *       MACRO_TAP(KEY_A), MACRO_TAP(KEY_ENTER), MACRO_END
+ *   };
+ *
+ * A tap of a regular key is a single byte and everything else two,
+ * so text costs about a byte a character.
+ * Declare macros constexpr at namespace scope, so that on ARM-based Teensy boards
+ * they stay in flash, as keymaps do.
+ */
+
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stdexcept>
+#include <stdint.h>
+#include "hardware_traits.h"
+#include "keymap.h"
+
+
+// Byte codes. Bytes from min_regular_scancode to max_regular_scancode are taps of that key.
+#define MACRO_END           0x00
+#define MACRO_OP_PRESS      0x01  // Followed by a scancode.
+#define MACRO_OP_RELEASE    0x02  // Followed by a scancode.
+#define MACRO_OP_DELAY      0x03  // Followed by a number of milliseconds, up to 255.
+#define MACRO_OP_MODIFIERS  0x7F  // Followed by the modifier bits to hold from now on.
+
+#define MACRO_TAP(key)          macro_scancode(key)
+#define MACRO_PRESS(key)        MACRO_OP_PRESS, macro_scancode(key)
+#define MACRO_RELEASE(key)      MACRO_OP_RELEASE, macro_scancode(key)
+#define MACRO_DELAY(millis)     MACRO_OP_DELAY, uint8_t(millis)
+#define MACRO_MODIFIERS(flags)  MACRO_OP_MODIFIERS, uint8_t((flags) & 0xFF)
+
+
+/**
+ * The scancode of a regular key code like KEY_A.
+ * Anything else is a compile-time error in a constexpr macro,
+ * and throws std::out_of_range at run time.
+ */
+constexpr uint8_t macro_scancode(uint16_t code) {
+    return KeymapEntry::classify(code) == KEY_CLASS_REGULAR ? code & 0xFF
+        : throw std::out_of_range("Not a regular key code");
+}
+
+
+/**
+ * Plays macros one report at a time, so the matrix is still scanned while one plays.
+ *
+ * Each call of loop sends at most one report, and no sooner than report_interval
+ * after the last, so hosts that drop reports that come too close together keep up.
+ * The default of 1 millisecond is one report per USB frame.
+ * A tap sends two reports, one with the key down and one with it up.
+ * When the macro ends everything it pressed is released.
+ *
+ * While a macro plays its reports replace those from KeyboardCortex:
+ *
+ *   player.loop(millis, keyboard);
+ *   if (!player.is_playing()) {
+ *       uint8_t number;
+ *       if (cortex.take_macro(number)) {
+ *           player.play(macros[number], millis);
+ *       } else {
+ *           keyboard.send_report(cortex.current_record());  // Sent only if it has changed.
+ *       }
+ *   }
+ */
+class MacroPlayer {
+    const uint8_t *next_op;  // Null when not playing.
+    keyboard_record record;  // The last report sent.
+    scancode_t tapped;  // Key to release at the next report, or 0.
+    millis_t report_interval;
+    millis_t next_millis;  // When loop can next do anything.
+
+public:
+    explicit MacroPlayer(millis_t report_interval_0 = 1):
+        next_op(nullptr), record(), tapped(0), report_interval(report_interval_0), next_millis(0)
+    {}
+
+    /**
+     * Start playing the macro, which must stay where it is until played.
+     * Returns false, doing nothing, if another macro is still playing.
+     */
+    bool play(const uint8_t *macro, millis_t millis) {
+        if (next_op) {
+            return false;
+        }
+        next_op = macro;
+        record = keyboard_record();
+        tapped = 0;
+        next_millis = millis;
+        return true;
+    }
+
+    /**
+     * Whether a macro is playing. Stays true for report_interval after its last report.
+     */
+    bool is_playing() const {
+        return next_op != nullptr;
+    }
+
+    /**
+     * Call every loop. Sends the macro's next report through Keyboard_t's send_report if one is due.
+     */
+    template<class Keyboard_t>
+    void loop(millis_t millis, Keyboard_t &keyboard) {
+        if (!next_op || static_cast<long>(millis - next_millis) < 0) {
+            return;
+        }
+        if (step(millis)) {
+            keyboard.send_report(record);
+            next_millis = millis + report_interval;
+        }
+    }
+
+private:
+    // Run the macro up to its next report, delay or end. Returns true if there is a report to send.
+    bool step(millis_t millis) {
+        if (tapped) {
+            record.remove_key(tapped);
+            tapped = 0;
+            return true;
+        }
+        for (;;) {
+            uint8_t op = *next_op++;
+            switch (op) {
+            case MACRO_END:
+                if (record != keyboard_record()) {
+                    record = keyboard_record();
+                    --next_op;  // Finish after this report's interval.
+                    return true;
+                }
+                next_op = nullptr;
+                return false;
+            case MACRO_OP_PRESS:
+                if (press(*next_op++)) {
+                    return true;
+                }
+                break;
+            case MACRO_OP_RELEASE:
+                if (record.remove_key(*next_op++)) {
+                    return true;
+                }
+                break;
+            case MACRO_OP_DELAY:
+                next_millis = millis + *next_op++;
+                return false;
+            case MACRO_OP_MODIFIERS: {
+                uint8_t bits = *next_op++;
+                modifier_flags_t flags = bits ? 0xE000 | bits : 0;
+                if (flags != record.modifier_flags) {
+                    record.modifier_flags = flags;
+                    return true;
+                }
+                break;
+            }
+            default:
+                // A tap. Does nothing if the key is already down.
+                if (press(op)) {
+                    tapped = op;
+                    return true;
+                }
+                break;
+            }
+        }
+    }
+
+    // Returns false if the key was already down or there was no room for it.
+    bool press(scancode_t scancode) {
+        for (scancode_t key : record.keys) {
+            if (key == scancode) {
+                return false;
+            }
+        }
+        return record.add_key(scancode);
+    }
+};
+
+
+#endif // MACRO_H
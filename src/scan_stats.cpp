@@ -0,0 +1,5 @@
+/**
+ * Implementation of scan instrumentation.
+ */
+
+#include "scan_stats.h"
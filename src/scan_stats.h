@@ -0,0 +1,213 @@
+/**
+ * Optional measurements of how long scanning the matrix takes.
+ */
+
+#ifndef SCAN_STATS_H
+#define SCAN_STATS_H
+
+#include <array>
+#include <stdint.h>
+#include "hardware_traits.h"
+
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+
+/**
+ * Durations are measured in ticks of whatever clock the instrumentation uses.
+ * They wrap round, so only differences are meaningful.
+ */
+typedef uint32_t scan_ticks_t;
+
+/**
+ * Where KeyboardMatrix spends the time of a scan.
+ */
+enum ScanPhase {
+    SCAN_PHASE_STROBE,  // Driving column pins. With static pins this is included in SCAN_PHASE_READ.
+    SCAN_PHASE_READ,  // Reading the rows.
+    SCAN_PHASE_GHOST_FILTER,  // Holding back possible ghosts, when the matrix has a ghost filter.
+    SCAN_PHASE_DEBOUNCE,  // Debouncing, including expiring lockouts.
+    SCAN_PHASE_RECORD,  // Recording presses and releases.
+    scan_phase_count
+};
+
+
+#ifndef ARDUINO
+/**
+ * Nanoseconds from std::chrono, for the host build.
+ */
+struct ChronoScanClock {
+    static scan_ticks_t ticks() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+#endif
+
+#ifdef ARM_DWT_CYCCNT
+/**
+ * CPU cycles from the ARM cycle counter, as provided by Teensy 3 and 4.
+ */
+struct CycleCounterScanClock {
+    static scan_ticks_t ticks() {
+        return ARM_DWT_CYCCNT;
+    }
+};
+#endif
+
+
+/**
+ * Counts of durations in buckets by powers of 2:
+ * bucket 0 for 0 ticks, then bucket k for 2^(k - 1) up to 2^k ticks.
+ * The last bucket also counts anything longer.
+ */
+struct ScanHistogram {
+    static const int bucket_count = 24;
+
+    std::array<uint32_t, bucket_count> counts;
+
+    ScanHistogram(): counts() {}
+
+    void add(scan_ticks_t ticks) {
+        ++counts[bucket_for(ticks)];
+    }
+
+    static int bucket_for(scan_ticks_t ticks) {
+        int bucket = 0;
+        while (ticks && bucket < bucket_count - 1) {
+            ticks >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    // Smallest duration counted in the bucket.
+    static scan_ticks_t lower_bound(int bucket) {
+        return bucket ? scan_ticks_t(1) << (bucket - 1) : 0;
+    }
+};
+
+
+/**
+ * Everything measured since the instrumentation was last reset.
+ */
+struct ScanStats {
+    // Scans are also grouped by how many switches were held at the end of the scan,
+    // with the last group for that many or more.
+    static const int held_group_count = 8;
+
+    uint32_t scans;
+    uint32_t edges;  // Presses and releases reported.
+    // Readings of a switch that differed from the state reported but were held back,
+    // counted on every scan until the change is reported, so one bounce can count several times.
+    uint32_t held_back_readings;
+    ScanHistogram scan_ticks;
+    std::array<ScanHistogram, scan_phase_count> phase_ticks;  // Time in each phase per scan.
+    std::array<uint32_t, held_group_count> held_scans;
+    std::array<uint64_t, held_group_count> held_ticks;  // Divide by held_scans for the mean.
+
+    ScanStats(): scans(0), edges(0), held_back_readings(0), scan_ticks(), phase_ticks(), held_scans(), held_ticks() {}
+};
+
+
+/**
+ * Default for KeyboardMatrix: measures nothing and compiles to nothing.
+ *
+ * Instrumentation is called at the start and end of each scan and phase
+ * with marks it hands out, and told what each column update did.
+ */
+struct NoScanInstrumentation {
+    struct mark_t {};
+
+    mark_t begin_scan() {
+        return mark_t();
+    }
+
+    // Called at the end of a phase with the mark from the end of the last one.
+    mark_t end_phase(ScanPhase, mark_t) {
+        return mark_t();
+    }
+
+    // disagreeing has bits for switches read differently from the state reported;
+    // changed has those now reported as changed.
+    template<typename Bits_t>
+    void column_updated(Bits_t, Bits_t) {}
+
+    void end_scan(int) {}
+};
+
+
+/**
+ * Measures scans with Clock_t, a type with a static ticks function
+ * such as ChronoScanClock on the host or CycleCounterScanClock on Teensy.
+ *
+ * If the matrix is scanned from an interrupt, take the snapshot with interrupts disabled.
+ */
+template<class Clock_t>
+class ScanInstrumentation {
+public:
+    typedef scan_ticks_t mark_t;
+
+private:
+    ScanStats stats;
+    scan_ticks_t scan_start;
+    std::array<scan_ticks_t, scan_phase_count> phase_totals;  // For the scan in progress.
+
+public:
+    ScanInstrumentation(): stats(), scan_start(0), phase_totals() {}
+
+    /**
+     * Copy of what has been measured so far.
+     */
+    ScanStats snapshot() const {
+        return stats;
+    }
+
+    void reset() {
+        stats = ScanStats();
+    }
+
+    mark_t begin_scan() {
+        phase_totals.fill(0);
+        scan_start = Clock_t::ticks();
+        return scan_start;
+    }
+
+    mark_t end_phase(ScanPhase phase, mark_t mark) {
+        scan_ticks_t now = Clock_t::ticks();
+        phase_totals[phase] += now - mark;
+        return now;
+    }
+
+    template<typename Bits_t>
+    void column_updated(Bits_t disagreeing, Bits_t changed) {
+        stats.edges += count_bits(changed);
+        stats.held_back_readings += count_bits(Bits_t(disagreeing & ~changed));
+    }
+
+    void end_scan(int held_count) {
+        scan_ticks_t ticks = Clock_t::ticks() - scan_start;
+        ++stats.scans;
+        stats.scan_ticks.add(ticks);
+        for (int phase = 0; phase < scan_phase_count; ++phase) {
+            stats.phase_ticks[phase].add(phase_totals[phase]);
+        }
+        int group = held_count < ScanStats::held_group_count ? held_count : ScanStats::held_group_count - 1;
+        ++stats.held_scans[group];
+        stats.held_ticks[group] += ticks;
+    }
+
+private:
+    template<typename Bits_t>
+    static int count_bits(Bits_t bits) {
+        int count = 0;
+        for (; bits; bits &= bits - 1) {
+            ++count;
+        }
+        return count;
+    }
+};
+
+
+#endif // SCAN_STATS_H
@@ -0,0 +1,5 @@
+/**
+ * Implementation of scheduler.
+ */
+
+#include "scheduler.h"
@@ -0,0 +1,153 @@
+/**
+ * Runs the components of the keyboard each at its own rate.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <array>
+#include "Arduino.h"
+#include "hardware_traits.h"
+
+
+/**
+ * A task is a function called with its context and the time.
+ */
+typedef void (*TaskFunction)(void *context, millis_t millis);
+
+/**
+ * How a task has behaved since its statistics were last reset.
+ */
+struct TaskStats {
+    unsigned long run_count;
+    unsigned long worst_micros;  // Longest a single run has taken.
+    unsigned long overrun_count;  // How many runs took longer than the task's budget.
+};
+
+
+/**
+ * Cooperative scheduler: calls each task when its period has passed.
+ *
+ * Every time round loop, each task that is due is run once, highest priority first,
+ * so a busy high-priority task delays the others but cannot stop them running.
+ * Give matrix scanning the shortest period and highest priority.
+ *
+ * Each run is timed with Clock_t, and the worst time kept for each task
+ * so tasks that take longer than their budget can be found.
+ */
+template<int capacity, class Clock_t = ClockTraits>
+class Scheduler {
+    struct Task {
+        TaskFunction run;
+        void *context;
+        millis_t period;
+        millis_t next_millis;  // When it is next due.
+        unsigned long budget_micros;  // 0 for no budget.
+        uint8_t priority;
+        bool started;  // Whether next_millis has been set from the time.
+        TaskStats stats;
+    };
+
+    std::array<Task, capacity> tasks;  // In the order added, so indexes stay valid.
+    std::array<uint8_t, capacity> order;  // Indexes of tasks, highest priority first.
+    int count;
+
+public:
+    Scheduler(): tasks(), order(), count(0) {}
+
+    /**
+     * Add a task that is first run at the next loop, then every period milliseconds.
+     * A period of 0 runs it every time round.
+     * Among tasks of the same priority, those added first run first.
+     * Returns an index for looking up its statistics, or -1 if there is no room.
+     */
+    int add_task(TaskFunction run, void *context, millis_t period, uint8_t priority, unsigned long budget_micros = 0) {
+        if (count == capacity) {
+            return -1;
+        }
+        int index = count++;
+        Task &task = tasks[index];
+        task.run = run;
+        task.context = context;
+        task.period = period;
+        task.budget_micros = budget_micros;
+        task.priority = priority;
+        task.stats = TaskStats();
+        task.next_millis = 0;
+        task.started = false;
+
+        int k = index;
+        for (; k > 0 && tasks[order[k - 1]].priority < priority; --k) {
+            order[k] = order[k - 1];
+        }
+        order[k] = index;
+        return index;
+    }
+
+    /**
+     * Add a component with a loop(millis) member function as a task.
+     */
+    template<class Component_t>
+    int add_loop(Component_t &component, millis_t period, uint8_t priority, unsigned long budget_micros = 0) {
+        return add_task(&call_loop<Component_t>, &component, period, priority, budget_micros);
+    }
+
+    /**
+     * Called repeatedly in Arduino's loop.
+     */
+    void loop(millis_t millis) {
+        for (int k = 0; k < count; ++k) {
+            Task &task = tasks[order[k]];
+            if (!task.started) {
+                task.started = true;
+                task.next_millis = millis;
+            }
+            if (static_cast<long>(millis - task.next_millis) < 0) {
+                continue;
+            }
+            run(task, millis);
+            task.next_millis += task.period;
+            if (static_cast<long>(millis - task.next_millis) >= 0) {
+                // Fell behind: skip the runs missed rather than running it repeatedly to catch up.
+                task.next_millis = millis + task.period;
+            }
+        }
+    }
+
+    const TaskStats &stats(int index) const {
+        return tasks[index].stats;
+    }
+
+    void reset_stats() {
+        for (int k = 0; k < count; ++k) {
+            tasks[k].stats = TaskStats();
+        }
+    }
+
+    int size() const {
+        return count;
+    }
+
+private:
+    void run(Task &task, millis_t millis) {
+        unsigned long start = Clock_t::micros();
+        task.run(task.context, millis);
+        unsigned long elapsed = Clock_t::micros() - start;
+
+        ++task.stats.run_count;
+        if (elapsed > task.stats.worst_micros) {
+            task.stats.worst_micros = elapsed;
+        }
+        if (task.budget_micros && elapsed > task.budget_micros) {
+            ++task.stats.overrun_count;
+        }
+    }
+
+    template<class Component_t>
+    static void call_loop(void *context, millis_t millis) {
+        static_cast<Component_t *>(context)->loop(millis);
+    }
+};
+
+
+#endif // SCHEDULER_H
@@ -0,0 +1,5 @@
+/**
+ * Implementation of the split keyboard link.
+ */
+
+#include "split_link.h"
@@ -0,0 +1,379 @@
+/**
+ * Link between the two halves of a split keyboard.
+ *
+ * The secondary half scans its own matrix and sends the changes to the primary half,
+ * which merges them with its own switches and does everything else.
+ * The link only moves bytes, so it can run over a serial line or anything else
+ * given a Link_t with these members:
+ *
+ *   void write(const uint8_t *bytes, int count);
+ *   bool read(uint8_t &byte);  // False if nothing has arrived.
+ *
+ * Only the first byte of a frame has its top bit set,
+ * so after a lost or garbled byte the receiver picks up again at the next frame.
+ *
+ *   header:   1 F N N S S S S  F for a full frame, NN one less than the changes in a delta frame,
+ *                               SSSS the low 4 bits of the sequence number.
+ *   sequence: 0 S S S S S S S  the top 7 bits of the 11-bit sequence number, in full frames only.
+ *   change:   0 P C C C C C C  cell C, numbered col * row_count + row, is now pressed if P.
+ *   state:    0 ...            7 cells to a byte, lowest cell in the lowest bit.
+ *   check:    0 ...            sum of the other bytes, in 7 bits.
+ *
+ * A delta frame is the header, 1 to 4 changes, and the check, so a keystroke costs 6 bytes.
+ * A full frame is the header, the sequence, the state of every cell, and the check.
+ * Delta frames only carry 4 bits of the sequence number, so a run of 16 lost
+ * goes unnoticed until the next full frame, which carries all of it.
+ *
+ * A change says what state a switch is now in rather than that it changed,
+ * so a lost frame only delays that switch until the next full frame,
+ * which the secondary sends every resync period whatever else happens.
+ * If nothing valid arrives for longer than the timeout, the primary releases
+ * every switch on the other half, so a pulled cable cannot leave a key held down.
+ */
+
+#ifndef SPLIT_LINK_H
+#define SPLIT_LINK_H
+
+#include <algorithm>
+#include <array>
+#include <stdint.h>
+#include "hardware_traits.h"
+#include "keyboard_matrix.h"
+
+
+/**
+ * How often the secondary sends the state of all its switches.
+ */
+const millis_t split_resync_millis = 100;
+
+/**
+ * How long the primary waits for a frame before releasing the other half's switches.
+ */
+const millis_t split_timeout_millis = 500;
+
+
+/**
+ * Frame layout for a half with cell_count switches, shared by sender and receiver.
+ */
+template<int cell_count>
+struct SplitFrames {
+    static_assert(cell_count <= 64, "At most 64 switches on each half");
+
+    static const uint8_t start = 0x80;
+    static const uint8_t full = 0x40;
+    static const uint8_t press = 0x40;
+    static const uint8_t cell_mask = 0x3F;
+    static const int header_sequence_mask = 0x0F;
+    static const int sequence_mask = 0x7FF;
+    static const int max_changes = 4;
+    static const int state_length = (cell_count + 6) / 7;
+    static const int max_length = 2 + (state_length + 1 > max_changes ? state_length + 1 : max_changes);
+
+    static uint64_t all_cells() {
+        return cell_count == 64 ? ~uint64_t(0) : (uint64_t(1) << cell_count) - 1;
+    }
+
+    static uint8_t header(bool is_full, int change_count, int sequence) {
+        return start | (is_full ? full : 0) | ((change_count - 1) & 3) << 4 | (sequence & header_sequence_mask);
+    }
+
+    // Bytes in the whole frame with this header.
+    static int length(uint8_t header) {
+        return 2 + ((header & full) ? 1 + state_length : ((header >> 4) & 3) + 1);
+    }
+
+    static uint8_t check(const uint8_t *bytes, int count) {
+        unsigned sum = 0;
+        for (int i = 0; i < count; ++i) {
+            sum += bytes[i];
+        }
+        return sum & 0x7F;
+    }
+};
+
+
+/**
+ * Runs on the secondary half: sends the presses and releases from its matrix.
+ */
+template<int column_count, int row_count>
+class SplitSender {
+    typedef SplitFrames<column_count * row_count> Frames;
+
+    uint64_t pressed;  // Cells pressed, as far as the primary has been told.
+    int sequence;
+    millis_t resync_period;
+    millis_t next_resync;
+    bool started;
+    std::array<uint8_t, Frames::max_length> frame;
+    int change_count;  // In the delta frame being built.
+
+public:
+    explicit SplitSender(millis_t resync_period_0 = split_resync_millis):
+        pressed(0), sequence(0), resync_period(resync_period_0), next_resync(0), started(false),
+        frame(), change_count(0)
+    {}
+
+    /**
+     * Call every loop, after the matrix's loop, with the ring given to its publish_events.
+     * Sends what changed, packed into as few frames as possible,
+     * then the state of every switch if a resync is due.
+     */
+    template<class Link_t>
+    void loop(SwitchEvents &events, millis_t millis, Link_t &link) {
+        SwitchEvent event;
+        while (events.pop(event)) {
+            int cell = event.col * row_count + event.row;
+            uint64_t bit = uint64_t(1) << cell;
+            pressed = event.is_press ? pressed | bit : pressed & ~bit;
+            frame[1 + change_count++] = (event.is_press ? Frames::press : 0) | cell;
+            if (change_count == Frames::max_changes) {
+                send_changes(link);
+            }
+        }
+        if (change_count) {
+            send_changes(link);
+        }
+        if (!started || static_cast<long>(millis - next_resync) >= 0) {
+            started = true;
+            send_state(link);
+            next_resync = millis + resync_period;
+        }
+    }
+
+private:
+    template<class Link_t>
+    void send_changes(Link_t &link) {
+        frame[0] = Frames::header(false, change_count, sequence);
+        send(1 + change_count, link);
+        change_count = 0;
+    }
+
+    template<class Link_t>
+    void send_state(Link_t &link) {
+        frame[0] = Frames::header(true, 1, sequence);
+        frame[1] = sequence >> 4;
+        for (int i = 0; i < Frames::state_length; ++i) {
+            frame[2 + i] = (pressed >> (7 * i)) & 0x7F;
+        }
+        send(2 + Frames::state_length, link);
+    }
+
+    template<class Link_t>
+    void send(int count, Link_t &link) {
+        frame[count] = Frames::check(frame.data(), count);
+        link.write(frame.data(), count + 1);
+        sequence = (sequence + 1) & Frames::sequence_mask;
+    }
+};
+
+
+/**
+ * What a SplitReceiver has seen of the link.
+ */
+struct SplitLinkStats {
+    unsigned long frames;  // Received intact.
+    unsigned long lost_frames;  // Missing from the sequence.
+    unsigned long bad_frames;  // Failed the check or were cut short.
+    unsigned long corrections;  // Full frames that disagreed with the changes before them.
+    unsigned long timeouts;
+
+    SplitLinkStats(): frames(0), lost_frames(0), bad_frames(0), corrections(0), timeouts(0) {}
+};
+
+
+/**
+ * Runs on the primary half: keeps track of the switches pressed on the secondary half,
+ * and publishes their presses and releases like a KeyboardMatrix does,
+ * with column_offset added to each column so they follow on from this half's.
+ */
+template<int column_count, int row_count>
+class SplitReceiver {
+    typedef SplitFrames<column_count * row_count> Frames;
+    typedef typename BitsFor<row_count>::type row_bits_t;
+
+    uint64_t pressed;
+    int column_offset;
+    millis_t timeout;
+    millis_t last_frame_millis;
+    bool is_connected;
+    int expected_sequence;
+    std::array<uint8_t, Frames::max_length> frame;
+    int received;  // Bytes of the frame so far, or 0 if waiting for one to start.
+    SwitchEvents switch_events;
+    SplitLinkStats link_stats;
+
+public:
+    explicit SplitReceiver(int column_offset_0, millis_t timeout_0 = split_timeout_millis):
+        pressed(0), column_offset(column_offset_0), timeout(timeout_0), last_frame_millis(0), is_connected(false),
+        expected_sequence(0), frame(), received(0), switch_events(), link_stats()
+    {}
+
+    /**
+     * Call every loop. Reads whatever has arrived, and releases everything if the link has gone quiet.
+     */
+    template<class Link_t>
+    void loop(millis_t millis, Link_t &link) {
+        uint8_t byte;
+        while (link.read(byte)) {
+            receive(byte, millis);
+        }
+        if (is_connected && static_cast<long>(millis - last_frame_millis) > static_cast<long>(timeout)) {
+            is_connected = false;
+            ++link_stats.timeouts;
+            set_pressed(0, millis);
+        }
+    }
+
+    void receive(uint8_t byte, millis_t millis) {
+        if (byte & Frames::start) {
+            if (received) {
+                ++link_stats.bad_frames;
+            }
+            received = 0;
+        } else if (!received) {
+            return;  // The rest of a frame whose start was lost.
+        }
+        frame[received++] = byte;
+        if (received == Frames::length(frame[0])) {
+            received = 0;
+            accept(millis);
+        }
+    }
+
+    /**
+     * Whether a frame has arrived within the timeout.
+     */
+    bool connected() const {
+        return is_connected;
+    }
+
+    /**
+     * Bitmask of rows pressed in the column, numbered as on the secondary half.
+     */
+    row_bits_t pressed_rows_in_column(int col) const {
+        return (pressed >> (col * row_count)) & ((uint64_t(1) << row_count) - 1);
+    }
+
+    SwitchEvents &events() {
+        return switch_events;
+    }
+
+    const SplitLinkStats &stats() const {
+        return link_stats;
+    }
+
+private:
+    void accept(millis_t millis) {
+        uint8_t header = frame[0];
+        int length = Frames::length(header);
+        if (frame[length - 1] != Frames::check(frame.data(), length - 1)) {
+            ++link_stats.bad_frames;
+            return;
+        }
+        ++link_stats.frames;
+        // A delta frame is taken to be the first one that could have its 4 bits;
+        // if more than that were lost the next full frame counts the rest.
+        int sequence = (header & Frames::full)
+            ? frame[1] << 4 | (header & Frames::header_sequence_mask)
+            : (expected_sequence + ((header - expected_sequence) & Frames::header_sequence_mask)) & Frames::sequence_mask;
+        bool was_connected = is_connected;
+        if (was_connected) {
+            link_stats.lost_frames += (sequence - expected_sequence) & Frames::sequence_mask;
+        }
+        expected_sequence = (sequence + 1) & Frames::sequence_mask;
+        is_connected = true;
+        last_frame_millis = millis;
+
+        if (header & Frames::full) {
+            uint64_t next = 0;
+            for (int i = 0; i < Frames::state_length; ++i) {
+                next |= uint64_t(frame[2 + i]) << (7 * i);
+            }
+            next &= Frames::all_cells();
+            if (was_connected && next != pressed) {
+                ++link_stats.corrections;
+            }
+            set_pressed(next, millis);
+        } else {
+            for (int i = 1; i < length - 1; ++i) {
+                int cell = frame[i] & Frames::cell_mask;
+                uint64_t bit = uint64_t(1) << cell;
+                set_pressed((frame[i] & Frames::press) ? pressed | bit : pressed & ~bit, millis);
+            }
+        }
+    }
+
+    void set_pressed(uint64_t next, millis_t millis) {
+        next &= Frames::all_cells();
+        for (uint64_t changed = pressed ^ next; changed; changed &= changed - 1) {
+            int cell = __builtin_ctzll(changed);
+            uint64_t bit = uint64_t(1) << cell;
+            switch_events.push(SwitchEvent(column_offset + cell / row_count, cell % row_count, (next & bit) != 0, millis));
+        }
+        pressed = next;
+    }
+};
+
+
+/**
+ * The switches pressed on both halves, in the order they were pressed,
+ * as one Switches for KeyboardCortex::record_from_switches.
+ * The size is that of the whole keyboard, and columns are numbered across both halves.
+ * Apply every event from this half's matrix and from the SplitReceiver as they are popped.
+ */
+template<int column_count, int row_count>
+class MergedSwitches {
+    static const int capacity = column_count * row_count;
+
+    std::array<Switch, capacity> switches;
+    int count;
+
+public:
+    MergedSwitches(): switches(), count(0) {}
+
+    void apply(const SwitchEvent &event) {
+        Switch sw(event.col, event.row, event.millis);
+        Switch *end = switches.data() + count;
+        Switch *found = std::find(switches.data(), end, sw);
+        if (event.is_press) {
+            if (found == end && count < capacity) {
+                switches[count++] = sw;
+            }
+        } else if (found != end) {
+            std::copy(found + 1, end, found);
+            --count;
+        }
+    }
+
+    Switches pressed_switches() const {
+        return Switches(switches.data(), count);
+    }
+};
+
+
+/**
+ * Link_t for an Arduino Stream such as Serial1.
+ */
+template<class Stream_t>
+class StreamLink {
+    Stream_t *stream;
+
+public:
+    explicit StreamLink(Stream_t &stream_0): stream(&stream_0) {}
+
+    void write(const uint8_t *bytes, int count) {
+        stream->write(bytes, count);
+    }
+
+    bool read(uint8_t &byte) {
+        int next = stream->read();
+        if (next < 0) {
+            return false;
+        }
+        byte = next;
+        return true;
+    }
+};
+
+
+#endif // SPLIT_LINK_H
@@ -0,0 +1,5 @@
+/**
+ * Implementation of single-producer, single-consumer ring.
+ */
+
+#include "spsc_ring.h"
@@ -0,0 +1,87 @@
+/**
+ * Fixed-capacity queue for passing items from one producer to one consumer.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+
+/**
+ * Ring buffer with a single producer and a single consumer.
+ *
+ * Needs no locks and no dynamic allocation, so the producer can run in
+ * a timer interrupt while the consumer runs in Arduino's loop (or in
+ * different threads in tests). Each index is only written by one side.
+ *
+ * When full, push drops the new item and counts it as an overflow.
+ */
+template<typename T, int capacity>
+class SpscRing {
+    static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "Capacity must be a power of 2");
+
+    std::array<T, capacity> items;
+
+    // Free-running counts of items pushed and popped. Index is count modulo capacity.
+    std::atomic<unsigned> head;  // Written by producer.
+    std::atomic<unsigned> tail;  // Written by consumer.
+    std::atomic<unsigned long> overflows;  // Written by producer.
+
+public:
+    SpscRing(): items(), head(0), tail(0), overflows(0) {}
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    /**
+     * Called by the producer. Returns false if the ring was full.
+     */
+    bool push(const T &item) {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == static_cast<unsigned>(capacity)) {
+            overflows.store(overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        items[h & (capacity - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Called by the consumer. Returns false if there was nothing to pop.
+     */
+    bool pop(T &item) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t) {
+            return false;
+        }
+        item = items[t & (capacity - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    size_t max_size() const {
+        return capacity;
+    }
+
+    /**
+     * How many items have been dropped because the ring was full.
+     */
+    unsigned long overflow_count() const {
+        return overflows.load(std::memory_order_relaxed);
+    }
+};
+
+
+#endif // SPSC_RING_H
@@ -0,0 +1,5 @@
+/**
+ * Implementation of dual-role keys.
+ */
+
+#include "tap_hold.h"
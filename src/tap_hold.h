@@ -0,0 +1,259 @@
+/**
+ * Dual-role keys: a modifier (or other key) when held, a regular key when tapped.
+ */
+
+#ifndef TAP_HOLD_H
+#define TAP_HOLD_H
+
+#include <array>
+#include "hardware_traits.h"
+#include "keyboard_matrix.h"
+#include "keymap.h"
+
+
+/**
+ * Fixed-capacity queue of items kept in order of deadline.
+ *
+ * Checking whether anything is due only looks at the earliest deadline.
+ * Deadlines are compared so that millis_t wrapping around is harmless,
+ * as long as none is more than half the range in the future.
+ */
+template<typename T, int capacity>
+class DeadlineQueue {
+public:
+    struct Item {
+        millis_t deadline;
+        T value;
+    };
+
+private:
+    std::array<Item, capacity> items;
+    int count;
+
+public:
+    DeadlineQueue(): items(), count(0) {}
+
+    /**
+     * Returns false if full.
+     */
+    bool push(millis_t deadline, const T &value) {
+        if (count == capacity) {
+            return false;
+        }
+        int k = count++;
+        for (; k > 0 && is_before(deadline, items[k - 1].deadline); --k) {
+            items[k] = items[k - 1];
+        }
+        items[k].deadline = deadline;
+        items[k].value = value;
+        return true;
+    }
+
+    /**
+     * If the earliest item is due at millis, remove it to result and return true.
+     */
+    bool pop_due(millis_t millis, Item &result) {
+        if (count == 0 || is_before(millis, items[0].deadline)) {
+            return false;
+        }
+        result = items[0];
+        remove(0);
+        return true;
+    }
+
+    void remove(int index) {
+        for (--count; index < count; ++index) {
+            items[index] = items[index + 1];
+        }
+    }
+
+    const Item &operator[](int index) const {
+        return items[index];
+    }
+
+    int size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    bool full() const {
+        return count == capacity;
+    }
+
+    static bool is_before(millis_t a, millis_t b) {
+        return static_cast<long>(a - b) < 0;
+    }
+};
+
+
+/**
+ * Declares a switch to be a dual-role key.
+ * If held for tapping_millis, or until another key is pressed, it means hold;
+ * if released sooner it means tap.
+ */
+struct TapHoldKey {
+    char col;
+    char row;
+    millis_t tapping_millis;
+    KeymapEntry hold;
+    KeymapEntry tap;
+};
+
+
+/**
+ * Stage between KeyboardMatrix and KeyboardCortex that holds back presses
+ * of dual-role keys until it can tell whether they are taps or holds.
+ *
+ * Events are passed on to a sink with the same apply functions as KeyboardCortex.
+ * Other keys are passed on straight away, so this adds no latency to them.
+ * Call loop every time round Arduino's loop to resolve keys held long enough.
+ */
+template<int capacity = 4>
+class TapHoldResolver {
+    // What a queued switch is waiting for.
+    enum Waiting {
+        WAITING_TAP_OR_HOLD,  // Deadline is when it becomes a hold.
+        WAITING_TAP_RELEASE,  // Tap has been pressed; deadline is when to release it.
+    };
+
+    struct Pending {
+        SwitchEvent press;
+        const TapHoldKey *key;
+        uint8_t waiting;
+    };
+
+    const TapHoldKey *keys;
+    int key_count;
+    DeadlineQueue<Pending, capacity> queue;
+
+public:
+    template<size_t key_count_0>
+    explicit TapHoldResolver(const std::array<TapHoldKey, key_count_0> &keys_0):
+        keys(keys_0.data()), key_count(key_count_0)
+    {}
+
+    /**
+     * Pass on the event, or hold it back if it is the press of a dual-role key.
+     */
+    template<class Sink_t>
+    void apply(const SwitchEvent &event, Sink_t &sink) {
+        // A key waiting to be released after a tap must be released before it is pressed again.
+        int index = find(event.col, event.row);
+        if (index >= 0 && queue[index].value.waiting == WAITING_TAP_RELEASE) {
+            release_tap(queue[index].value, event.millis, sink);
+            queue.remove(index);
+            index = -1;
+        }
+
+        if (event.is_press) {
+            // Another key being pressed means any undecided keys are being held.
+            resolve_holds(sink);
+            const TapHoldKey *key = find_key(event.col, event.row);
+            if (key) {
+                if (queue.full()) {
+                    fire_earliest(sink);
+                }
+                queue.push(event.millis + key->tapping_millis, Pending {event, key, WAITING_TAP_OR_HOLD});
+            } else {
+                sink.apply(event);
+            }
+        } else if (index >= 0) {
+            // Released before it was decided, so it is a tap.
+            Pending pending = queue[index].value;
+            queue.remove(index);
+            sink.apply(pending.press, pending.key->tap);
+            // Released next time round, so the tap is seen by the host.
+            pending.waiting = WAITING_TAP_RELEASE;
+            queue.push(event.millis + 1, pending);
+        } else {
+            sink.apply(event);
+        }
+    }
+
+    template<class Sink_t>
+    void apply(SwitchEvents &events, Sink_t &sink) {
+        SwitchEvent event;
+        while (events.pop(event)) {
+            apply(event, sink);
+        }
+    }
+
+    /**
+     * Resolve keys whose time is up. Only looks at the earliest deadline.
+     */
+    template<class Sink_t>
+    void loop(millis_t millis, Sink_t &sink) {
+        typename DeadlineQueue<Pending, capacity>::Item item;
+        while (queue.pop_due(millis, item)) {
+            fire(item, sink);
+        }
+    }
+
+    /**
+     * Whether any dual-role keys are waiting to be decided or released.
+     */
+    bool is_pending() const {
+        return !queue.empty();
+    }
+
+private:
+    template<class Sink_t>
+    void fire(const typename DeadlineQueue<Pending, capacity>::Item &item, Sink_t &sink) {
+        if (item.value.waiting == WAITING_TAP_OR_HOLD) {
+            SwitchEvent press = item.value.press;
+            press.millis = item.deadline;
+            sink.apply(press, item.value.key->hold);
+        } else {
+            release_tap(item.value, item.deadline, sink);
+        }
+    }
+
+    template<class Sink_t>
+    void fire_earliest(Sink_t &sink) {
+        typename DeadlineQueue<Pending, capacity>::Item item = queue[0];
+        queue.remove(0);
+        fire(item, sink);
+    }
+
+    template<class Sink_t>
+    void resolve_holds(Sink_t &sink) {
+        for (int k = 0; k < queue.size(); ) {
+            if (queue[k].value.waiting == WAITING_TAP_OR_HOLD) {
+                Pending pending = queue[k].value;
+                queue.remove(k);
+                sink.apply(pending.press, pending.key->hold);
+            } else {
+                ++k;
+            }
+        }
+    }
+
+    template<class Sink_t>
+    void release_tap(const Pending &pending, millis_t millis, Sink_t &sink) {
+        sink.apply(SwitchEvent(pending.press.col, pending.press.row, false, millis));
+    }
+
+    int find(char col, char row) const {
+        for (int k = 0; k < queue.size(); ++k) {
+            if (queue[k].value.press.col == col && queue[k].value.press.row == row) {
+                return k;
+            }
+        }
+        return -1;
+    }
+
+    const TapHoldKey *find_key(char col, char row) const {
+        for (int k = 0; k < key_count; ++k) {
+            if (keys[k].col == col && keys[k].row == row) {
+                return &keys[k];
+            }
+        }
+        return nullptr;
+    }
+};
+
+
+#endif // TAP_HOLD_H
@@ -0,0 +1,5 @@
+/**
+ * Implementation of timer wheel.
+ */
+
+#include "timer_wheel.h"
@@ -0,0 +1,264 @@
+/**
+ * Deadlines for the components that do things at particular times.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <array>
+#include "hardware_traits.h"
+
+
+/**
+ * Hierarchical timer wheel with room for capacity timers.
+ *
+ * Each timer has a deadline and a tag saying what it is for.
+ * loop jumps straight to the next slot holding timers, and there only
+ * looks at the timers due then, so it costs next to nothing when nothing expires.
+ *
+ * Level 0 has a slot per millisecond for the next 2^slot_bits milliseconds,
+ * and each level above has slots 2^slot_bits times as wide.
+ * Timers further off than the top level covers wait in its furthest slot
+ * and are placed again when it comes round.
+ *
+ * Deadlines are compared so that millis_t wrapping around is harmless,
+ * as long as none is more than half the range in the future.
+ */
+template<int capacity, int level_count = 3, int slot_bits = 4>
+class TimerWheel {
+    static_assert(capacity > 0 && capacity < 0x8000, "Between 1 and 32767 timers supported");
+
+    static const int slot_count = 1 << slot_bits;
+    static const millis_t slot_mask = slot_count - 1;
+    static const int16_t none = -1;
+
+    struct Entry {
+        millis_t deadline;
+        uint16_t tag;
+        int16_t next;  // Next entry in the same slot, or in the free list.
+    };
+
+    std::array<Entry, capacity> entries;
+    std::array<std::array<int16_t, slot_count>, level_count> slots;  // Heads of lists of entries.
+    int16_t free_list;
+    int count;
+    millis_t current;  // Timers due up to this time have been fired.
+
+public:
+    explicit TimerWheel(millis_t millis = 0): entries(), count(0), current(millis) {
+        for (auto &level : slots) {
+            level.fill(none);
+        }
+        for (int k = 0; k < capacity; ++k) {
+            entries[k].next = k + 1 < capacity ? k + 1 : none;
+        }
+        free_list = 0;
+    }
+
+    /**
+     * Arrange for the tag to be passed to the handler when deadline is reached.
+     * Deadlines are relative to now, so call loop first to bring the wheel up to date.
+     * A deadline already past is fired by the next call to loop.
+     * Returns false if the wheel is full.
+     */
+    bool schedule(millis_t deadline, uint16_t tag) {
+        if (free_list == none) {
+            return false;
+        }
+        int16_t index = free_list;
+        free_list = entries[index].next;
+        entries[index].deadline = deadline;
+        entries[index].tag = tag;
+        place(index);
+        ++count;
+        return true;
+    }
+
+    /**
+     * Advance to millis, calling handler(tag, deadline) for each timer that expires.
+     * Timers due in different milliseconds are fired in order.
+     * The handler may schedule more timers.
+     */
+    template<class Handler_t>
+    void loop(millis_t millis, Handler_t handler) {
+        // Timers scheduled for a time already reached.
+        fire_slot(handler);
+        while (current != millis) {
+            if (count == 0) {
+                current = millis;
+                break;
+            }
+            current += next_occupied(millis - current);
+            cascade();
+            fire_slot(handler);
+        }
+    }
+
+    /**
+     * The time the wheel has reached.
+     */
+    millis_t now() const {
+        return current;
+    }
+
+    int size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    int max_size() const {
+        return capacity;
+    }
+
+private:
+    static int shift(int level) {
+        return slot_bits * level;
+    }
+
+    void place(int16_t index) {
+        Entry &entry = entries[index];
+        millis_t delta = entry.deadline - current;
+        int level = 0;
+        millis_t slot_time;
+        if (static_cast<long>(delta) <= 0) {
+            slot_time = current;
+        } else {
+            while (level < level_count && delta >> shift(level + 1)) {
+                ++level;
+            }
+            if (level == level_count) {
+                // Too far off: wait in the last slot of the top level.
+                level = level_count - 1;
+                slot_time = current + (millis_t(slot_count - 1) << shift(level));
+            } else {
+                slot_time = entry.deadline;
+            }
+        }
+        int16_t &head = slots[level][(slot_time >> shift(level)) & slot_mask];
+        entry.next = head;
+        head = index;
+    }
+
+    // How far ahead the next slot holding timers is fired or cascaded, or limit if that is sooner.
+    // Nothing happens in the slots between, so they can be skipped.
+    millis_t next_occupied(millis_t limit) const {
+        millis_t best = limit;
+        for (int level = 0; level < level_count; ++level) {
+            millis_t base = current >> shift(level);
+            for (millis_t k = 1; k <= millis_t(slot_count); ++k) {
+                millis_t distance = ((base + k) << shift(level)) - current;
+                if (distance >= best) {
+                    break;
+                }
+                if (slots[level][(base + k) & slot_mask] != none) {
+                    best = distance;
+                    break;
+                }
+            }
+        }
+        return best;
+    }
+
+    // When a level wraps round, move the timers in the next slot of the level above down.
+    void cascade() {
+        int top = 0;
+        while (top + 1 < level_count && !(current & ((millis_t(1) << shift(top + 1)) - 1))) {
+            ++top;
+        }
+        for (int level = top; level > 0; --level) {
+            int16_t &head = slots[level][(current >> shift(level)) & slot_mask];
+            int16_t index = head;
+            head = none;
+            while (index != none) {
+                int16_t next = entries[index].next;
+                place(index);
+                index = next;
+            }
+        }
+    }
+
+    template<class Handler_t>
+    void fire_slot(Handler_t &handler) {
+        // Taken one at a time, since the handler may add timers already due to this slot.
+        int16_t &head = slots[0][current & slot_mask];
+        while (head != none) {
+            int16_t index = head;
+            head = entries[index].next;
+            if (static_cast<long>(entries[index].deadline - current) > 0) {
+                // Cannot be this slot again, as level 0 only holds the next 2^slot_bits milliseconds.
+                place(index);
+                continue;
+            }
+            Entry entry = entries[index];
+            entries[index].next = free_list;
+            free_list = index;
+            --count;
+            handler(entry.tag, entry.deadline);
+        }
+    }
+};
+
+template<int capacity, int level_count, int slot_bits>
+const int16_t TimerWheel<capacity, level_count, slot_bits>::none;
+
+
+/**
+ * Advances a wheel and passes each timer that expires to the timer_expired(deadline)
+ * of the component attached to its tag, so that the wheel can be run as a Scheduler task:
+ *
+ *   TimerWheel<4> wheel;
+ *   TimerDispatcher<TimerWheel<4>, 2> timers(wheel);
+ *   BlinkingThing<> heartbeat(wheel, 0, LED_BUILTIN, 500, 1000);
+ *   timers.attach(0, heartbeat);
+ *   scheduler.add_loop(timers, 1, 0);
+ *
+ * Tags from 0 to tag_count - 1 can be attached. Timers with other tags are dropped.
+ */
+template<class Wheel_t, int tag_count>
+class TimerDispatcher {
+    typedef void (*ExpiredFunction)(void *component, millis_t deadline);
+
+    struct Target {
+        ExpiredFunction expired;
+        void *component;
+    };
+
+    Wheel_t *wheel;
+    std::array<Target, tag_count> targets;  // Indexed by tag.
+
+public:
+    explicit TimerDispatcher(Wheel_t &wheel_0): wheel(&wheel_0), targets() {}
+
+    /**
+     * Pass timers with this tag on to the component, which must outlive the dispatcher.
+     * Returns false if the tag is out of range.
+     */
+    template<class Component_t>
+    bool attach(uint16_t tag, Component_t &component) {
+        if (tag >= tag_count) {
+            return false;
+        }
+        targets[tag] = Target {&call_expired<Component_t>, &component};
+        return true;
+    }
+
+    void loop(millis_t millis) {
+        wheel->loop(millis, [this](uint16_t tag, millis_t deadline) {
+            if (tag < tag_count && targets[tag].expired) {
+                targets[tag].expired(targets[tag].component, deadline);
+            }
+        });
+    }
+
+private:
+    template<class Component_t>
+    static void call_expired(void *component, millis_t deadline) {
+        static_cast<Component_t *>(component)->timer_expired(deadline);
+    }
+};
+
+
+#endif // TIMER_WHEEL_H
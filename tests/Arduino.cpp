@@ -27,6 +27,48 @@ void digitalWrite(int, int) {
     ADD_FAILURE() << "Cannot call real digitalWrite function in unit tests";
 }
 
+uint8_t digitalPinToPort(uint8_t) {
+    ADD_FAILURE() << "Cannot call real digitalPinToPort function in unit tests";
+    return 0;
+}
+
+uint8_t digitalPinToBitMask(uint8_t) {
+    ADD_FAILURE() << "Cannot call real digitalPinToBitMask function in unit tests";
+    return 0;
+}
+
+volatile uint8_t *portInputRegister(uint8_t) {
+    ADD_FAILURE() << "Cannot call real portInputRegister function in unit tests";
+    return nullptr;
+}
+
+void digitalWriteFast(uint8_t, uint8_t) {
+    ADD_FAILURE() << "Cannot call real digitalWriteFast function in unit tests";
+}
+
+uint8_t digitalReadFast(uint8_t) {
+    ADD_FAILURE() << "Cannot call real digitalReadFast function in unit tests";
+    return 0;
+}
+
+int digitalPinToInterrupt(int) {
+    ADD_FAILURE() << "Cannot call real digitalPinToInterrupt function in unit tests";
+    return -1;
+}
+
+void attachInterrupt(int, void (*)(), int) {
+    ADD_FAILURE() << "Cannot call real attachInterrupt function in unit tests";
+}
+
+void detachInterrupt(int) {
+    ADD_FAILURE() << "Cannot call real detachInterrupt function in unit tests";
+}
+
+unsigned long micros() {
+    ADD_FAILURE() << "Cannot call real micros function in unit tests";
+    return 0;
+}
+
 
 void Keyboard_t::set_modifier(uint16_t) {
     ADD_FAILURE() << "Cannot call real Keyboard_t::set_modifier in unit tests";
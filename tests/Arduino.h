@@ -7,6 +7,8 @@
 #ifndef FAKE_ARDUINO_H
 #define FAKE_ARDUINO_H
 
+#include <array>
+#include <cstdint>
 #include <vector>
 
 #define HIGH 1
@@ -17,6 +19,7 @@
 #define INPUT_PULLDOWN 3
 #define OUTPUT_OPENDRAIN 4
 #define INPUT_DISABLE 5
+#define FALLING 2
 
 
 
@@ -31,6 +34,16 @@
 void pinMode(int pin, int mode);
 int digitalRead(int pin);
 void digitalWrite(int pin, int value);
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+volatile uint8_t *portInputRegister(uint8_t port);
+void digitalWriteFast(uint8_t pin, uint8_t value);
+uint8_t digitalReadFast(uint8_t pin);
+#define NOT_AN_INTERRUPT -1
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(int interrupt, void (*function)(), int mode);
+void detachInterrupt(int interrupt);
+unsigned long micros();
 
 struct Keyboard_t {
     void set_modifier(uint16_t flags);
@@ -46,6 +59,8 @@ struct Keyboard_t {
 extern Keyboard_t Keyboard;
 
 
+class FakePort;
+
 class FakePinListener {
 public:
     virtual void on_mode_changed(int) {}
@@ -61,9 +76,20 @@ class FakePin {
     int mode;
     int value;
     std::vector<FakePinListener *> listeners;
+    const FakePort *port;
+    uint32_t bit_mask;
+    bool wake_interrupt;
 
 public:
-    FakePin(): mode(-1), value(-1) {}
+    FakePin(): mode(-1), value(-1), port(nullptr), bit_mask(0), wake_interrupt(false) {}
+
+    void set_port(const FakePort *next_port, uint32_t next_bit_mask) {
+        port = next_port;
+        bit_mask = next_bit_mask;
+    }
+
+    const FakePort *get_port() const { return port; }
+    uint32_t get_bit_mask() const { return bit_mask; }
 
     void add_listener(FakePinListener *listener) {
         listeners.push_back(listener);
@@ -87,9 +113,43 @@ public:
         }
     }
 
+    void set_wake_interrupt(bool is_attached) { wake_interrupt = is_attached; }
+    bool has_wake_interrupt() const { return wake_interrupt; }
+
     int is_low() { return value == LOW; }
     int is_high() { return value == HIGH; }
-    int is_floating() { return mode == INPUT; }
+    int is_floating() { return mode == INPUT || (mode == OUTPUT_OPENDRAIN && value == HIGH); }
+};
+
+/*
+* Fake I/O port: a group of pins that can be read in one go.
+* Counts the reads so tests can check pins were read together.
+*/
+class FakePort {
+    std::vector<const FakePin *> pins;
+    mutable int read_count;
+
+public:
+    FakePort(): read_count(0) {}
+
+    // Pins are assigned bits in the order they are added.
+    void add_pin(FakePin *pin) {
+        pin->set_port(this, 1u << pins.size());
+        pins.push_back(pin);
+    }
+
+    uint32_t read() const {
+        ++read_count;
+        uint32_t result = 0;
+        for (auto pin : pins) {
+            if (pin->get_value() == HIGH) {
+                result |= pin->get_bit_mask();
+            }
+        }
+        return result;
+    }
+
+    int get_read_count() const { return read_count; }
 };
 
 /*
@@ -111,8 +171,112 @@ struct FakePinTraits {
     static int digitalRead(const FakePin *pin_ptr) {
         return pin_ptr->get_value();
     }
+
+    // Pins added to a FakePort can be read together.
+    typedef const FakePort *port_t;
+    typedef uint32_t port_bits_t;
+
+    static port_t digitalPinPort(const FakePin *pin_ptr) {
+        return pin_ptr->get_port();
+    }
+
+    static port_bits_t digitalPinBitMask(const FakePin *pin_ptr) {
+        return pin_ptr->get_bit_mask();
+    }
+
+    static port_bits_t readPort(port_t port) {
+        return port->read();
+    }
+
+    static void attachWakeInterrupt(FakePin *pin_ptr) {
+        pin_ptr->set_wake_interrupt(true);
+    }
+
+    static void detachWakeInterrupt(FakePin *pin_ptr) {
+        pin_ptr->set_wake_interrupt(false);
+    }
 };
 
 
+/*
+* Records one call made through FakeFastPinTraits.
+*/
+struct FakePinOperation {
+    enum Kind { PIN_MODE, WRITE, READ };
+
+    Kind kind;
+    int pin;
+    int value;  // Mode, value written, or value read.
+
+    bool operator==(const FakePinOperation &other) const {
+        return kind == other.kind && pin == other.pin && value == other.value;
+    }
+};
+
+/*
+* Use this as Fast_t argument of StaticMatrixPinTraits.
+* Pin numbers index a table of FakePins filled in by the test,
+* and every call is recorded so tests can check the sequence of operations.
+* The table is shared by all tests, so call reset at the start of each one.
+*/
+struct FakeFastPinTraits {
+    static const int max_pins = 64;
+
+    static std::array<FakePin *, max_pins> &pins() {
+        static std::array<FakePin *, max_pins> table;
+        return table;
+    }
+
+    static std::vector<FakePinOperation> &operations() {
+        static std::vector<FakePinOperation> log;
+        return log;
+    }
+
+    static void reset() {
+        pins().fill(nullptr);
+        operations().clear();
+    }
+
+    template<int pin>
+    static void pinMode(int mode) {
+        operations().push_back({FakePinOperation::PIN_MODE, pin, mode});
+        pins()[pin]->set_mode(mode);
+    }
+
+    template<int pin>
+    static void digitalWrite(int value) {
+        operations().push_back({FakePinOperation::WRITE, pin, value});
+        pins()[pin]->set_value(value);
+    }
+
+    template<int pin>
+    static int digitalRead() {
+        int value = pins()[pin]->get_value();
+        operations().push_back({FakePinOperation::READ, pin, value});
+        return value;
+    }
+};
+
+
+/*
+* Use this as Clock_t argument of things that time themselves.
+* The time only changes when the test says so.
+* It is shared by all tests, so set it at the start of each one.
+*/
+struct FakeClockTraits {
+    static unsigned long &now_micros() {
+        static unsigned long value;
+        return value;
+    }
+
+    static void advance_micros(unsigned long delta) {
+        now_micros() += delta;
+    }
+
+    static unsigned long micros() {
+        return now_micros();
+    }
+};
+
 
 #endif // FAKE_ARDUINO_H
@@ -5,58 +5,8 @@
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
-#include <array>
-#include <vector>
 #include "hardware_traits.h"
 
-// struct FakeKeyboardListener {
-//     virtual void on_keyboard_sent(modifier_flags_t modifier_flags, const std::array<scancode_t, 6> &keys) = 0;
-// };
-
-// struct FakeKeyboardTraits {
-//     modifier_flags_t modifier_flags;
-//     std::array<scancode_t, 6> keys[6];
-//     std::vector<FakeKeyboardListener *> listeners;
-
-//     FakeKeyboardTraits(): modifier_flags{0}, keys{} {
-
-//     }
-
-//     void add_keyboard_listener(FakeKeyboardListener *listener) {
-//         listeners.push_back(listener);
-//     }
-
-//     void set_modifier(modifier_flags_t next_modifier_flags) {
-//         modifier_flags = next_modifier_flags;
-//     }
-
-//     void set_key1(scancode_t key) {
-//         keys[0] = key;
-//     }
-//     void set_key2(scancode_t key) {
-//         keys[1] = key;
-//     }
-//     void set_key3(scancode_t key) {
-//         keys[2] = key;
-//     }
-//     void set_key4(scancode_t key) {
-//         keys[3] = key;
-//     }
-//     void set_key5(scancode_t key) {
-//         keys[4] = key;
-//     }
-//     void set_key6(scancode_t key) {
-//         keys[5] = key;
-//     }
-
-//     void send_now() {
-//         for (FakeKeyboardListener *listener : listeners) {
-//             listener->on_keyboard_sent(modifier_flags, keys);
-//         }
-//     }
-// };
-
-
 // Following snarfed from one of the Teensy header files.
 // Note that the upper 8 bits are used for categorization
 // and are not actually passed through to the USB controller
@@ -0,0 +1,54 @@
+/*
+ * Fake keyboard traits for tests.
+ */
+
+#ifndef FAKE_KEYBOARD_H
+#define FAKE_KEYBOARD_H
+
+#include <vector>
+#include "hardware_traits.h"
+
+
+/*
+* Use in place of KeyboardTraits.
+* Keeps every report actually sent, so tests can count USB transfers.
+* Like KeyboardTraits it remembers the last report sent, so each test needs its own.
+*/
+struct FakeKeyboardTraits: KeyboardReports<FakeKeyboardTraits> {
+    keyboard_record next;  // As set so far.
+    std::vector<keyboard_record> sent;
+
+    void set_modifier(modifier_flags_t flags) {
+        next.modifier_flags = flags;
+    }
+
+    void set_key1(scancode_t scancode) {
+        next.keys[0] = scancode;
+    }
+    void set_key2(scancode_t scancode) {
+        next.keys[1] = scancode;
+    }
+    void set_key3(scancode_t scancode) {
+        next.keys[2] = scancode;
+    }
+    void set_key4(scancode_t scancode) {
+        next.keys[3] = scancode;
+    }
+    void set_key5(scancode_t scancode) {
+        next.keys[4] = scancode;
+    }
+    void set_key6(scancode_t scancode) {
+        next.keys[5] = scancode;
+    }
+
+    void send_now() {
+        sent.push_back(next);
+    }
+
+    size_t send_count() const {
+        return sent.size();
+    }
+};
+
+
+#endif // FAKE_KEYBOARD_H
@@ -0,0 +1,276 @@
+/*
+ * Fake keyboard matrix circuit for tests, benchmarks and simulations.
+ */
+
+#ifndef FAKE_MATRIX_H
+#define FAKE_MATRIX_H
+
+#include <array>
+#include <stdint.h>
+#include "Arduino.h"
+
+
+/*
+* The switches and wires of a keyboard matrix, held as bitmasks:
+* for each column, the rows whose switches are closed.
+* Rows are pulled up, and read LOW when connected to a column pulled LOW.
+*
+* With a diode on each switch a column only pulls down the rows of its own closed switches.
+* Without diodes current also flows back through other closed switches,
+* so when three corners of a rectangle are closed the fourth reads as closed too: ghosting.
+*
+* Which rows are LOW is only worked out again when read after something has changed,
+* so reading a row is usually a single bit test.
+* Up to 32 columns and 32 rows.
+*/
+class FakeMatrix {
+public:
+    enum Wiring { WITH_DIODES, WITHOUT_DIODES };
+
+    static const int max_columns = 32;
+    static const int max_rows = 32;
+
+private:
+    std::array<uint32_t, max_columns> closed;  // Rows closed, for each column.
+    uint32_t columns_with_closed;  // Bit for each column with any switch closed.
+    uint32_t driven;  // Columns pulled LOW.
+    Wiring wiring;
+    mutable uint32_t low_rows;
+    mutable bool is_stale;
+
+public:
+    constexpr explicit FakeMatrix(Wiring wiring_0 = WITH_DIODES):
+        closed(), columns_with_closed(0), driven(0), wiring(wiring_0), low_rows(0), is_stale(false)
+    {}
+
+    // Open all the switches and let all the columns float.
+    void reset(Wiring next_wiring = WITH_DIODES) {
+        *this = FakeMatrix(next_wiring);
+    }
+
+    void set_closed(int col, int row, bool is_closed) {
+        uint32_t bit = uint32_t(1) << row;
+        closed[col] = is_closed ? closed[col] | bit : closed[col] & ~bit;
+        columns_with_closed = closed[col] ? columns_with_closed | column_bit(col) : columns_with_closed & ~column_bit(col);
+        is_stale = true;
+    }
+
+    // Close exactly the switches listed as pairs of column and row.
+    template<class Pairs_t>
+    void set_closed_switches(const Pairs_t &switches) {
+        closed.fill(0);
+        columns_with_closed = 0;
+        for (const auto &pr : switches) {
+            set_closed(pr.first, pr.second, true);
+        }
+        is_stale = true;
+    }
+
+    bool is_closed(int col, int row) const {
+        return (closed[col] >> row) & 1;
+    }
+
+    // Bitmask of the rows whose switches are closed in the column.
+    uint32_t closed_rows(int col) const {
+        return closed[col];
+    }
+
+    // Pull the column LOW, or let it float.
+    void drive_column(int col, bool is_low) {
+        uint32_t next = is_low ? driven | column_bit(col) : driven & ~column_bit(col);
+        if (next == driven) {
+            return;
+        }
+        driven = next;
+        if (wiring == WITH_DIODES && !is_stale && !(next & (next - 1))) {
+            // Scanning drives one column at a time, so this is the usual case.
+            low_rows = next ? closed[col] : 0;
+        } else {
+            is_stale = true;
+        }
+    }
+
+    uint32_t driven_columns() const {
+        return driven;
+    }
+
+    // Bitmask of the rows that read LOW.
+    uint32_t rows_low() const {
+        if (is_stale) {
+            low_rows = connected_rows();
+            is_stale = false;
+        }
+        return low_rows;
+    }
+
+    bool is_row_low(int row) const {
+        return (rows_low() >> row) & 1;
+    }
+
+private:
+    static uint32_t column_bit(int col) {
+        return uint32_t(1) << col;
+    }
+
+    static int lowest_bit(uint32_t bits) {
+        return __builtin_ctz(bits);
+    }
+
+    uint32_t connected_rows() const {
+        uint32_t rows = 0;
+        for (uint32_t left = driven; left; left &= left - 1) {
+            rows |= closed[lowest_bit(left)];
+        }
+        if (wiring == WITH_DIODES) {
+            return rows;
+        }
+
+        // Follow closed switches from the rows pulled down to more columns, and on to their rows.
+        uint32_t reached = driven;
+        for (;;) {
+            uint32_t more = 0;
+            for (uint32_t left = columns_with_closed & ~reached; left; left &= left - 1) {
+                int col = lowest_bit(left);
+                if (closed[col] & rows) {
+                    more |= column_bit(col);
+                    rows |= closed[col];
+                }
+            }
+            if (!more) {
+                return rows;
+            }
+            reached |= more;
+        }
+    }
+};
+
+
+/*
+* A column of a FakeMatrix, as a FakePin.
+* The column is pulled LOW while the pin is an output written LOW.
+* Remembers if it was ever driven HIGH, which would fight any column pulled LOW.
+*/
+class FakeMatrixColumnPin: public FakePin {
+    FakeMatrix *matrix;
+    int col;
+    bool was_driven_high;
+
+public:
+    FakeMatrixColumnPin(): matrix(nullptr), col(0), was_driven_high(false) {}
+
+    void connect(FakeMatrix *next_matrix, int next_col) {
+        matrix = next_matrix;
+        col = next_col;
+    }
+
+    bool has_been_driven_high() const {
+        return was_driven_high;
+    }
+
+    void set_mode(int next_mode) override {
+        FakePin::set_mode(next_mode);
+        update();
+    }
+
+    void set_value(int next_value) override {
+        FakePin::set_value(next_value);
+        update();
+    }
+
+private:
+    void update() {
+        bool is_floating = get_mode() == INPUT || (get_mode() == OUTPUT_OPENDRAIN && get_value() == HIGH);
+        if (!is_floating && get_value() == HIGH) {
+            was_driven_high = true;
+        }
+        matrix->drive_column(col, !is_floating && get_value() == LOW);
+    }
+};
+
+
+/*
+* A row of a FakeMatrix, as a FakePin. Its value is whatever the matrix says.
+*/
+class FakeMatrixRowPin: public FakePin {
+    const FakeMatrix *matrix;
+    int row;
+
+public:
+    FakeMatrixRowPin(): matrix(nullptr), row(0) {}
+
+    void connect(const FakeMatrix *next_matrix, int next_row) {
+        matrix = next_matrix;
+        row = next_row;
+    }
+
+    int get_value() const override {
+        return matrix->is_row_low(row) ? LOW : HIGH;
+    }
+};
+
+
+// Pin numbers first + 0, first + 1, ... as an array, whose elements must be const.
+template<int... indexes>
+struct Indexes {};
+
+template<int count, int... indexes>
+struct MakeIndexes: MakeIndexes<count - 1, count - 1, indexes...> {};
+
+template<int... indexes>
+struct MakeIndexes<0, indexes...> {
+    typedef Indexes<indexes...> type;
+};
+
+template<int... indexes>
+std::array<const int, sizeof...(indexes)> pin_numbers(int first, Indexes<indexes...>) {
+    return {{ (first + indexes)... }};
+}
+
+
+/*
+* Pin traits for a FakeMatrix with numbered pins, for when FakePins would be too slow:
+* columns are pins 0 up and rows are pins from row_pin_base up.
+* A column is pulled LOW from when it is written LOW until its mode is set to an input.
+* The matrix is shared, as the functions are static, so reset it before use.
+*/
+struct FakeMatrixPinTraits {
+    static const int row_pin_base = 100;
+
+    static FakeMatrix &matrix() {
+        static FakeMatrix shared;
+        return shared;
+    }
+
+    static void reset(FakeMatrix::Wiring wiring = FakeMatrix::WITH_DIODES) {
+        matrix().reset(wiring);
+    }
+
+    template<int count>
+    static std::array<const int, count> column_pins() {
+        return pin_numbers(0, typename MakeIndexes<count>::type());
+    }
+
+    template<int count>
+    static std::array<const int, count> row_pins() {
+        return pin_numbers(row_pin_base, typename MakeIndexes<count>::type());
+    }
+
+    static void pinMode(int pin, int mode) {
+        if (pin < row_pin_base && mode != OUTPUT && mode != OUTPUT_OPENDRAIN) {
+            matrix().drive_column(pin, false);
+        }
+    }
+
+    static void digitalWrite(int pin, int value) {
+        if (pin < row_pin_base) {
+            matrix().drive_column(pin, value == LOW);
+        }
+    }
+
+    static int digitalRead(int pin) {
+        return matrix().is_row_low(pin - row_pin_base) ? LOW : HIGH;
+    }
+};
+
+
+#endif // FAKE_MATRIX_H
@@ -0,0 +1,87 @@
+/*
+ * Fake link between the halves of a split keyboard, for tests.
+ */
+
+#ifndef LOOPBACK_LINK_H
+#define LOOPBACK_LINK_H
+
+#include <deque>
+#include <random>
+#include <stdint.h>
+#include "hardware_traits.h"
+
+
+/*
+* Use in place of a serial line: bytes written can be read back after the delay, in order,
+* unless lost on the way.
+* Tests can lose whole writes on purpose, or single bytes at random from a fixed seed
+* so that every run loses the same ones.
+* Time only moves on when the test sets it.
+*/
+class LoopbackLink {
+    struct InFlight {
+        uint8_t byte;
+        millis_t arrives;
+    };
+
+    std::deque<InFlight> wire;
+    millis_t now;
+    millis_t delay;
+    int writes_to_drop;
+    double byte_loss;
+    std::mt19937 random;
+    unsigned long bytes_written;
+
+public:
+    LoopbackLink(): wire(), now(0), delay(0), writes_to_drop(0), byte_loss(0), random(1), bytes_written(0) {}
+
+    void set_millis(millis_t millis) {
+        now = millis;
+    }
+
+    void set_delay(millis_t millis) {
+        delay = millis;
+    }
+
+    // Lose everything in the next count writes.
+    void drop_next_writes(int count) {
+        writes_to_drop = count;
+    }
+
+    // Lose each byte with this probability.
+    void set_byte_loss(double probability, unsigned seed = 1) {
+        byte_loss = probability;
+        random.seed(seed);
+    }
+
+    // Bytes written so far, whether or not they arrived.
+    unsigned long byte_count() const {
+        return bytes_written;
+    }
+
+    void write(const uint8_t *bytes, int count) {
+        bytes_written += count;
+        if (writes_to_drop) {
+            --writes_to_drop;
+            return;
+        }
+        std::bernoulli_distribution is_lost(byte_loss);
+        for (int i = 0; i < count; ++i) {
+            if (!is_lost(random)) {
+                wire.push_back({bytes[i], now + delay});
+            }
+        }
+    }
+
+    bool read(uint8_t &byte) {
+        if (wire.empty() || static_cast<long>(wire.front().arrives - now) > 0) {
+            return false;
+        }
+        byte = wire.front().byte;
+        wire.pop_front();
+        return true;
+    }
+};
+
+
+#endif // LOOPBACK_LINK_H
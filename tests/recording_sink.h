@@ -0,0 +1,60 @@
+/*
+ * Fake sink for stages between KeyboardMatrix and KeyboardCortex, for tests.
+ */
+
+#ifndef RECORDING_SINK_H
+#define RECORDING_SINK_H
+
+#include <ostream>
+#include <vector>
+#include "keyboard_matrix.h"
+#include "keymap.h"
+
+
+/**
+ * What a stage passed on, and with what meaning.
+ */
+struct ForwardedEvent {
+    SwitchEvent event;
+    bool has_entry;
+    KeymapEntry entry;
+
+    bool operator==(const ForwardedEvent &other) const {
+        return event == other.event && has_entry == other.has_entry && (!has_entry || entry == other.entry);
+    }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const ForwardedEvent &forwarded) {
+    out << "(" << int(forwarded.event.col) << ", " << int(forwarded.event.row)
+        << (forwarded.event.is_press ? " press" : " release") << " @" << forwarded.event.millis;
+    if (forwarded.has_entry) {
+        out << " as " << int(forwarded.entry.key_class) << ":" << int(forwarded.entry.code);
+    }
+    return out << ")";
+}
+
+/**
+ * Stands in for KeyboardCortex, recording what it is given.
+ */
+struct RecordingSink {
+    std::vector<ForwardedEvent> forwarded;
+
+    void apply(const SwitchEvent &event) {
+        forwarded.push_back(ForwardedEvent {event, false, KeymapEntry()});
+    }
+
+    void apply(const SwitchEvent &event, const KeymapEntry &entry) {
+        forwarded.push_back(ForwardedEvent {event, true, entry});
+    }
+};
+
+inline ForwardedEvent passed(int col, int row, bool is_press, millis_t millis) {
+    return ForwardedEvent {SwitchEvent(col, row, is_press, millis), false, KeymapEntry()};
+}
+
+inline ForwardedEvent pressed_as(int col, int row, millis_t millis, KeymapEntry entry) {
+    return ForwardedEvent {SwitchEvent(col, row, true, millis), true, entry};
+}
+
+
+#endif // RECORDING_SINK_H
@@ -1,19 +1,28 @@
 /* Tests for blinking_thing. */
 
+#include <vector>
 #include "Arduino.h"
 #include "gtest/gtest.h"
 #include "blinking_thing.h"
 
 class BlinkingThingTest: public ::testing::Test {
 public:
-    BlinkingThingTest(): blinking_thing(&pin, 500, 1000) {
+    BlinkingThingTest(): blinking_thing(wheel, 0, &pin, 500, 1000) {
     }
 
-    void given_blinking_thing_timing(unsigned long off_millis, unsigned long on_millis) {
-        blinking_thing = BlinkingThing<FakePin *, FakePinTraits>(&pin, off_millis, on_millis);
+    void given_blinking_thing_timing(unsigned long off_millis, unsigned long on_millis, millis_t millis = 0) {
+        wheel = TimerWheel<4>(millis);
+        blinking_thing = BlinkingThing<FakePin *, FakePinTraits>(wheel, 0, &pin, off_millis, on_millis);
+    }
+
+    void when_loop(millis_t millis) {
+        wheel.loop(millis, [this](uint16_t, millis_t deadline) {
+            blinking_thing.timer_expired(deadline);
+        });
     }
 
     FakePin pin;
+    TimerWheel<4> wheel;
     BlinkingThing<FakePin *, FakePinTraits> blinking_thing;
 };
 
@@ -26,7 +35,7 @@ TEST_F(BlinkingThingTest, StartsLow) {
 TEST_F(BlinkingThingTest, After500MillisSetsHigh) {
     given_blinking_thing_timing(500, 1000);
 
-    blinking_thing.loop(500);
+    when_loop(500);
 
     EXPECT_EQ(pin.get_value(), HIGH);
 }
@@ -35,33 +44,33 @@ TEST_F(BlinkingThingTest, After500MillisSetsHigh) {
 TEST_F(BlinkingThingTest, AlternatesLowAndHigh) {
     given_blinking_thing_timing(500, 1000);
 
-    blinking_thing.loop(555);
+    when_loop(555);
     EXPECT_EQ(pin.get_value(), HIGH);
-    blinking_thing.loop(666);
+    when_loop(666);
     EXPECT_EQ(pin.get_value(), HIGH);
-    blinking_thing.loop(500 + 1000);
+    when_loop(500 + 1000);
     EXPECT_EQ(pin.get_value(), LOW);
 
-    blinking_thing.loop(500 + 1000 + 500);
+    when_loop(500 + 1000 + 500);
     EXPECT_EQ(pin.get_value(), HIGH);
 
-    blinking_thing.loop(500 + 1000 + 500 + 1000);
+    when_loop(500 + 1000 + 500 + 1000);
     EXPECT_EQ(pin.get_value(), LOW);
 }
 
 TEST_F(BlinkingThingTest, SetsScheduleFromparams) {
     given_blinking_thing_timing(333, 667);
 
-    blinking_thing.loop(332);
+    when_loop(332);
     EXPECT_EQ(pin.get_value(), LOW);
 
-    blinking_thing.loop(333);
+    when_loop(333);
     EXPECT_EQ(pin.get_value(), HIGH);
 
-    blinking_thing.loop(333 + 667);
+    when_loop(333 + 667);
     EXPECT_EQ(pin.get_value(), LOW);
 
-    blinking_thing.loop(333 + 667 + 333);
+    when_loop(333 + 667 + 333);
     EXPECT_EQ(pin.get_value(), HIGH);
 }
 
@@ -71,6 +80,66 @@ TEST_F(BlinkingThingTest, SetsScheduleFromparams) {
 TEST_F(BlinkingThingTest, CanSkipFirstCycle) {
     given_blinking_thing_timing(333, 667);
 
-    blinking_thing.loop(333 + 667);
+    when_loop(333 + 667);
+    EXPECT_EQ(pin.get_value(), LOW);
+}
+
+TEST_F(BlinkingThingTest, JoinsCyclePartWayThrough) {
+    given_blinking_thing_timing(333, 667, 1000 + 500);
+    EXPECT_EQ(pin.get_value(), HIGH);
+
+    when_loop(1000 + 999);
+    EXPECT_EQ(pin.get_value(), HIGH);
+    when_loop(1000 + 1000);
     EXPECT_EQ(pin.get_value(), LOW);
 }
+
+TEST_F(BlinkingThingTest, KeepsTimeWhenMillisWrapsAround) {
+    millis_t before_wrap = millis_t(0) - 1000;
+    given_blinking_thing_timing(300, 700, before_wrap);
+
+    // Find the times it changes over the wrap and check they are the right distance apart.
+    std::vector<millis_t> changes;
+    std::vector<int> values;
+    for (millis_t millis = before_wrap; millis != before_wrap + 3000; ++millis) {
+        when_loop(millis);
+        if (values.empty() || pin.get_value() != values.back()) {
+            changes.push_back(millis);
+            values.push_back(pin.get_value());
+        }
+    }
+    ASSERT_EQ(7u, changes.size());
+    for (size_t k = 2; k < changes.size(); ++k) {
+        EXPECT_EQ(values[k - 1] == HIGH ? 700u : 300u, changes[k] - changes[k - 1]) << "Change " << k;
+    }
+}
+
+TEST(BlinkingThingFullWheelTest, ReportsFullWheelAndStartsOnceThereIsRoom) {
+    FakePin pin;
+    TimerWheel<1> wheel;
+    wheel.schedule(100, 1);
+    BlinkingThing<FakePin *, FakePinTraits, TimerWheel<1> > blinking_thing(wheel, 0, &pin, 500, 1000);
+    EXPECT_FALSE(blinking_thing.is_running());
+
+    wheel.loop(100, [](uint16_t, millis_t) {});
+    EXPECT_TRUE(blinking_thing.start());
+
+    wheel.loop(500, [&](uint16_t, millis_t deadline) { blinking_thing.timer_expired(deadline); });
+    EXPECT_EQ(pin.get_value(), HIGH);
+    EXPECT_TRUE(blinking_thing.is_running());
+}
+
+TEST(BlinkingThingFullWheelTest, StopsWhenWheelFullAtChange) {
+    FakePin pin;
+    TimerWheel<1> wheel;
+    BlinkingThing<FakePin *, FakePinTraits, TimerWheel<1> > blinking_thing(wheel, 0, &pin, 500, 1000);
+    ASSERT_TRUE(blinking_thing.is_running());
+
+    wheel.loop(500, [&](uint16_t, millis_t deadline) {
+        wheel.schedule(10000, 1);  // Something else takes the room first.
+        blinking_thing.timer_expired(deadline);
+    });
+
+    EXPECT_EQ(pin.get_value(), HIGH);
+    EXPECT_FALSE(blinking_thing.is_running());
+}
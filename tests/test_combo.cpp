@@ -0,0 +1,194 @@
+/* Tests for combo. */
+
+#include <stdexcept>
+#include <vector>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "combo.h"
+#include "keyboard_cortex.h"
+#include "keymap.h"
+#include "recording_sink.h"
+
+using namespace std;
+
+
+// Switches A to D are row 0 of columns 0 to 3. Row 1 is in no combo.
+constexpr combo_mask_t combo_a = combo_switch<3>(0, 0);
+constexpr combo_mask_t combo_b = combo_switch<3>(1, 0);
+constexpr combo_mask_t combo_c = combo_switch<3>(2, 0);
+constexpr combo_mask_t combo_d = combo_switch<3>(3, 0);
+
+constexpr Combo combo_list[] = {
+    {combo_a | combo_b, KEY_ESC},
+    {combo_b | combo_c, KEY_TAB},
+    {combo_a | combo_b | combo_c, KEY_ENTER},
+    {combo_c | combo_d, KEY_SPACE},
+};
+
+constexpr ComboTable combos(combo_list);
+
+
+class ComboResolverTest: public ::testing::Test {
+public:
+    ComboResolver<3> resolver;
+    RecordingSink sink;
+
+    ComboResolverTest(): resolver(combos) {}
+
+    void when_event(int col, int row, bool is_press, millis_t millis) {
+        resolver.apply(SwitchEvent(col, row, is_press, millis), sink);
+    }
+
+    void when_loop(millis_t millis) {
+        resolver.loop(millis, sink);
+    }
+
+    void then_forwarded(vector<ForwardedEvent> expected) {
+        EXPECT_EQ(expected, sink.forwarded);
+        sink.forwarded.clear();
+    }
+};
+
+
+TEST_F(ComboResolverTest, PassesOnSwitchesInNoComboAtOnce) {
+    when_event(0, 1, true, 10);
+    when_event(0, 1, false, 20);
+
+    then_forwarded({passed(0, 1, true, 10), passed(0, 1, false, 20)});
+}
+
+TEST_F(ComboResolverTest, HoldsBackSwitchThatCouldStartCombo) {
+    when_event(0, 0, true, 10);
+
+    then_forwarded({});
+    EXPECT_TRUE(resolver.is_pending());
+}
+
+TEST_F(ComboResolverTest, PressesComboAtOnceWhenNoBiggerOneIsPossible) {
+    when_event(3, 0, true, 10);
+    when_event(2, 0, true, 15);
+
+    then_forwarded({pressed_as(2, 0, 15, KEY_SPACE)});
+    EXPECT_FALSE(resolver.is_pending());
+}
+
+TEST_F(ComboResolverTest, WaitsForWindowWhenBiggerComboIsPossible) {
+    when_event(0, 0, true, 10);
+    when_event(1, 0, true, 20);
+    when_loop(59);
+    then_forwarded({});
+
+    when_loop(60);
+    then_forwarded({pressed_as(0, 0, 20, KEY_ESC)});
+}
+
+TEST_F(ComboResolverTest, PrefersBiggerCombo) {
+    when_event(1, 0, true, 10);
+    when_event(0, 0, true, 11);
+    when_event(2, 0, true, 12);
+
+    then_forwarded({pressed_as(0, 0, 12, KEY_ENTER)});
+}
+
+TEST_F(ComboResolverTest, PassesOnPressesAsTheyWereWhenWindowIsUp) {
+    when_event(0, 0, true, 10);
+    when_loop(60);
+
+    then_forwarded({passed(0, 0, true, 10)});
+}
+
+TEST_F(ComboResolverTest, PassesOnPressesWhenComboCannotBeCompleted) {
+    when_event(0, 0, true, 10);
+    when_event(3, 0, true, 20);
+
+    then_forwarded({passed(0, 0, true, 10)});
+    EXPECT_TRUE(resolver.is_pending());  // D could still be part of C + D.
+}
+
+TEST_F(ComboResolverTest, PassesOnPressesWhenOtherSwitchPressed) {
+    when_event(0, 0, true, 10);
+    when_event(0, 1, true, 20);
+
+    then_forwarded({passed(0, 0, true, 10), passed(0, 1, true, 20)});
+}
+
+TEST_F(ComboResolverTest, PassesOnPressAndReleaseWhenTappedAlone) {
+    when_event(1, 0, true, 10);
+    when_event(1, 0, false, 30);
+
+    then_forwarded({passed(1, 0, true, 10), passed(1, 0, false, 30)});
+}
+
+TEST_F(ComboResolverTest, PressesComboWhenReleasedWithinWindow) {
+    when_event(0, 0, true, 10);
+    when_event(1, 0, true, 20);
+    when_event(1, 0, false, 30);
+
+    then_forwarded({pressed_as(0, 0, 20, KEY_ESC), passed(0, 0, false, 30)});
+}
+
+TEST_F(ComboResolverTest, ReleasesComboWhenFirstSwitchReleased) {
+    when_event(2, 0, true, 10);
+    when_event(3, 0, true, 11);
+    when_event(3, 0, false, 100);
+    then_forwarded({pressed_as(2, 0, 11, KEY_SPACE), passed(2, 0, false, 100)});
+
+    when_event(2, 0, false, 110);
+    then_forwarded({});
+
+    when_event(2, 0, true, 200);
+    when_loop(250);
+    then_forwarded({passed(2, 0, true, 200)});
+}
+
+TEST(ComboTableTest, RejectsCombosOutOfOrder) {
+    Combo unsorted[] = {
+        {combo_b | combo_c, KEY_TAB},
+        {combo_a | combo_b, KEY_ESC},
+    };
+
+    EXPECT_THROW(ComboTable table(unsorted), std::invalid_argument);
+}
+
+TEST(ComboSwitchTest, OnlyFirst64SwitchesCanBeInCombos) {
+    EXPECT_EQ(combo_switch<8>(7, 7), combo_mask_t(1) << 63);
+    EXPECT_THROW(combo_switch<8>(8, 0), std::out_of_range);
+}
+
+TEST(ComboResolverManyTest, FindsComboAmongHundreds) {
+    // Every pair of the first 24 switches, in order of mask.
+    static Combo many[276];
+    int count = 0;
+    for (int high = 1; high < 24; ++high) {
+        for (int low = 0; low < high; ++low) {
+            many[count++] = Combo {(combo_mask_t(1) << high) | (combo_mask_t(1) << low), KeymapEntry(KEY_A + count % 26)};
+        }
+    }
+    ComboResolver<4> resolver((ComboTable(many)));
+    RecordingSink sink;
+
+    resolver.apply(SwitchEvent(5, 2, true, 10), sink);  // Switch 22.
+    resolver.apply(SwitchEvent(0, 3, true, 11), sink);  // Switch 3.
+    resolver.loop(60, sink);
+
+    ASSERT_EQ(sink.forwarded.size(), 1u);
+    EXPECT_EQ(sink.forwarded[0], pressed_as(0, 3, 11, many[22 * 21 / 2 + 3].entry));
+}
+
+TEST(ComboResolverCortexTest, ReportsComboEntry) {
+    static constexpr KeyboardCortex<1, 4, 3>::Keymap keymap = {{
+        {{
+            {{ KEY_Q, KEY_W, KEY_E, KEY_R }},
+        }},
+    }};
+    KeyboardCortex<1, 4, 3> cortex(keymap);
+    ComboResolver<3> resolver(combos);
+
+    resolver.apply(SwitchEvent(2, 0, true, 10), cortex);
+    resolver.apply(SwitchEvent(3, 0, true, 11), cortex);
+    EXPECT_EQ(cortex.current_record().keys[0], KEY_SPACE & 0xFF);
+    EXPECT_EQ(cortex.current_record().keys[1], 0);
+
+    resolver.apply(SwitchEvent(2, 0, false, 20), cortex);
+    EXPECT_EQ(cortex.current_record().keys[0], 0);
+}
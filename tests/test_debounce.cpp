@@ -0,0 +1,240 @@
+/* Tests for debounce. */
+
+#include <cstdint>
+#include <vector>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "debounce.h"
+
+using namespace std;
+
+
+/**
+ * Test fixture with a debouncer for a single column of 8 rows.
+ */
+template<class Debounce_t>
+class DebounceTest: public ::testing::Test {
+public:
+    typename Debounce_t::template Debouncer<1, 8, uint8_t> debouncer;
+    uint8_t reported = 0;
+
+    void given_sampled(millis_t millis, uint8_t sampled) {
+        when_sampled(millis, sampled);
+    }
+
+    void when_sampled(millis_t millis, uint8_t sampled) {
+        reported = debouncer.update(0, sampled, reported, millis);
+    }
+
+    // Sample once per millisecond from start, returning what was reported after each.
+    vector<uint8_t> when_sampled_each_milli(millis_t start, vector<uint8_t> samples) {
+        vector<uint8_t> result;
+        for (uint8_t sampled : samples) {
+            when_sampled(start++, sampled);
+            result.push_back(reported);
+        }
+        return result;
+    }
+};
+
+typedef DebounceTest<LockoutDebounce<> > LockoutDebounceTest;
+typedef DebounceTest<VerticalCounterDebounce> VerticalCounterDebounceTest;
+
+
+TEST_F(LockoutDebounceTest, ReportsPressAtOnce) {
+    when_sampled(100, 0x04);
+
+    EXPECT_EQ(reported, 0x04);
+}
+
+TEST_F(LockoutDebounceTest, IgnoresReleaseWithinWindow) {
+    given_sampled(100, 0x04);
+
+    when_sampled(100 + debounce_millis - 1, 0x00);
+
+    EXPECT_EQ(reported, 0x04);
+}
+
+TEST_F(LockoutDebounceTest, ReportsReleaseAfterWindow) {
+    given_sampled(100, 0x04);
+
+    when_sampled(100 + debounce_millis, 0x00);
+
+    EXPECT_EQ(reported, 0x00);
+}
+
+TEST_F(LockoutDebounceTest, LocksOutEachSwitchSeparately) {
+    given_sampled(100, 0x04);
+    given_sampled(120, 0x05);
+
+    when_sampled(100 + debounce_millis, 0x00);
+
+    EXPECT_EQ(reported, 0x01);
+}
+
+TEST_F(LockoutDebounceTest, ReportsChatterAsPress) {
+    vector<uint8_t> result = when_sampled_each_milli(100, {0x00, 0x01, 0x00, 0x00, 0x00, 0x00});
+
+    EXPECT_EQ(result, vector<uint8_t>({0x00, 0x01, 0x01, 0x01, 0x01, 0x01}));
+}
+
+TEST_F(VerticalCounterDebounceTest, ReportsPressAfterFourSamples) {
+    vector<uint8_t> result = when_sampled_each_milli(100, {0x04, 0x04, 0x04, 0x04});
+
+    EXPECT_EQ(result, vector<uint8_t>({0x00, 0x00, 0x00, 0x04}));
+}
+
+TEST_F(VerticalCounterDebounceTest, ReportsReleaseAfterFourSamples) {
+    when_sampled_each_milli(100, {0x04, 0x04, 0x04, 0x04});
+
+    vector<uint8_t> result = when_sampled_each_milli(200, {0x00, 0x00, 0x00, 0x00});
+
+    EXPECT_EQ(result, vector<uint8_t>({0x04, 0x04, 0x04, 0x00}));
+}
+
+TEST_F(VerticalCounterDebounceTest, RejectsChatter) {
+    vector<uint8_t> result = when_sampled_each_milli(100, {0x00, 0x01, 0x00, 0x01, 0x01, 0x01, 0x00, 0x00});
+
+    EXPECT_EQ(result, vector<uint8_t>(8, 0x00));
+}
+
+TEST_F(VerticalCounterDebounceTest, CountsEachSwitchSeparately) {
+    vector<uint8_t> result = when_sampled_each_milli(100, {0x01, 0x03, 0x03, 0x83, 0x82, 0x82, 0x82, 0x82});
+
+    EXPECT_EQ(result, vector<uint8_t>({0x00, 0x00, 0x00, 0x01, 0x03, 0x03, 0x83, 0x82}));
+}
+
+
+/**
+ * Runs a keystroke through a debouncer and measures how late it reports the edges.
+ *
+ * The switch bounces for bounce_millis after closing and again after opening,
+ * flipping every millisecond, and is sampled once a millisecond.
+ */
+template<class Debounce_t>
+class DebounceLatencyTest: public ::testing::Test {
+public:
+    struct Latency {
+        millis_t press;
+        millis_t release;
+    };
+
+    static const millis_t hold_millis = 100;
+
+    Latency when_key_struck(millis_t bounce_millis) {
+        typename Debounce_t::template Debouncer<1, 1, uint8_t> debouncer;
+        uint8_t reported = 0;
+        const millis_t pressed_at = 1000;
+        const millis_t released_at = pressed_at + hold_millis;
+        Latency result = {0, 0};
+        bool seen_press = false;
+        for (millis_t millis = pressed_at - 10; millis < released_at + hold_millis; ++millis) {
+            uint8_t sampled;
+            if (millis < pressed_at) {
+                sampled = 0;
+            } else if (millis < pressed_at + bounce_millis) {
+                sampled = (millis - pressed_at) % 2 == 0;
+            } else if (millis < released_at) {
+                sampled = 1;
+            } else if (millis < released_at + bounce_millis) {
+                sampled = (millis - released_at) % 2 != 0;
+            } else {
+                sampled = 0;
+            }
+            uint8_t next = debouncer.update(0, sampled, reported, millis);
+            if (next && !reported && !seen_press) {
+                result.press = millis - pressed_at;
+                seen_press = true;
+            }
+            if (!next && reported) {
+                result.release = millis - released_at;
+            }
+            reported = next;
+        }
+        EXPECT_TRUE(seen_press);
+        EXPECT_EQ(reported, 0);
+        return result;
+    }
+
+    // Worst case over bounces lasting up to max_bounce_millis.
+    Latency when_keys_struck(millis_t max_bounce_millis) {
+        Latency worst = {0, 0};
+        for (millis_t bounce_millis = 0; bounce_millis <= max_bounce_millis; ++bounce_millis) {
+            Latency latency = when_key_struck(bounce_millis);
+            worst.press = max(worst.press, latency.press);
+            worst.release = max(worst.release, latency.release);
+        }
+        return worst;
+    }
+};
+
+typedef DebounceLatencyTest<EagerPressDebounce<5> > EagerPressLatencyTest;
+typedef DebounceLatencyTest<EagerReleaseDebounce<5> > EagerReleaseLatencyTest;
+typedef DebounceLatencyTest<IntegratingDebounce<3, 8> > IntegratingLatencyTest;
+typedef DebounceLatencyTest<LockoutDebounce<> > LockoutLatencyTest;
+
+
+TEST_F(EagerPressLatencyTest, AddsNoLatencyToPress) {
+    Latency worst = when_keys_struck(4);
+
+    EXPECT_EQ(worst.press, 0);
+}
+
+TEST_F(EagerPressLatencyTest, DelaysReleaseByWindowAfterBouncing) {
+    Latency worst = when_keys_struck(4);
+
+    // Last bounce closed at 3 ms, so open from 4 ms and reported 5 ms later.
+    EXPECT_EQ(worst.release, 4 + 5);
+}
+
+TEST_F(EagerReleaseLatencyTest, AddsNoLatencyToRelease) {
+    Latency worst = when_keys_struck(4);
+
+    EXPECT_EQ(worst.release, 0);
+}
+
+TEST_F(EagerReleaseLatencyTest, DelaysPressByWindowAfterBouncing) {
+    Latency worst = when_keys_struck(4);
+
+    // Last bounce opened at 3 ms, so closed from 4 ms and reported 5 ms later.
+    EXPECT_EQ(worst.press, 4 + 5);
+}
+
+TEST_F(IntegratingLatencyTest, UsesSeparateWindowsForPressAndRelease) {
+    Latency worst = when_keys_struck(0);
+
+    EXPECT_EQ(worst.press, 3);
+    EXPECT_EQ(worst.release, 8);
+}
+
+TEST_F(LockoutLatencyTest, AddsNoLatencyToEitherEdge) {
+    Latency worst = when_keys_struck(4);
+
+    EXPECT_EQ(worst.press, 0);
+    EXPECT_EQ(worst.release, 0);
+}
+
+
+typedef DebounceTest<EagerPressDebounce<5> > EagerPressDebounceTest;
+
+
+TEST_F(EagerPressDebounceTest, ReportsQuickRepressAtOnce) {
+    given_sampled(100, 0x01);
+    given_sampled(110, 0x00);
+    given_sampled(115, 0x00);
+    ASSERT_EQ(reported, 0x00);
+
+    when_sampled(116, 0x01);
+
+    EXPECT_EQ(reported, 0x01);
+}
+
+TEST_F(EagerPressDebounceTest, RestartsReleaseWindowWhenSwitchBounces) {
+    given_sampled(100, 0x01);
+    given_sampled(110, 0x00);
+    given_sampled(113, 0x01);
+
+    when_sampled(116, 0x00);
+
+    EXPECT_EQ(reported, 0x01);
+}
@@ -0,0 +1,100 @@
+/* Tests for ghost_filter. */
+
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "Arduino.h"
+#include "fake_matrix.h"
+#include "gtest/gtest.h"
+#include "ghost_filter.h"
+
+using namespace std;
+
+
+/**
+ * Test fixture with a filter for 4 columns of 8 rows.
+ */
+class RectangleGhostFilterTest: public ::testing::Test {
+public:
+    static const int column_count = 4;
+    typedef array<uint8_t, column_count> Columns;
+
+    RectangleGhostFilter::Filter<column_count, uint8_t> filter;
+    Columns reported = {};
+
+    Columns when_filtered(Columns sampled) {
+        filter.filter(sampled, reported);
+        return sampled;
+    }
+
+    // What each column reads when driven in turn, as the matrix scans it.
+    Columns read_circuit(const FakeMatrix &circuit) {
+        FakeMatrix scanned = circuit;
+        Columns result;
+        for (int i = 0; i < column_count; ++i) {
+            scanned.drive_column(i, true);
+            result[i] = scanned.rows_low();
+            scanned.drive_column(i, false);
+        }
+        return result;
+    }
+};
+
+const int RectangleGhostFilterTest::column_count;
+
+
+TEST_F(RectangleGhostFilterTest, PassesSwitchesWithNoSharedRows) {
+    Columns sampled = {{0x03, 0x04, 0x00, 0x81}};
+
+    EXPECT_EQ(when_filtered(sampled), sampled);
+}
+
+TEST_F(RectangleGhostFilterTest, PassesSwitchesSharingOneRow) {
+    Columns sampled = {{0x03, 0x01, 0x01, 0x00}};
+
+    EXPECT_EQ(when_filtered(sampled), sampled);
+    EXPECT_EQ(filter.ambiguous_rows(0), 0);
+}
+
+TEST_F(RectangleGhostFilterTest, HoldsBackNewPressesInRectangle) {
+    reported = {{0x01, 0x01, 0x00, 0x00}};
+
+    Columns result = when_filtered({{0x03, 0x03, 0x10, 0x00}});
+
+    EXPECT_EQ(result, Columns({{0x01, 0x01, 0x10, 0x00}}));
+    EXPECT_EQ(filter.ambiguous_rows(0), 0x03);
+    EXPECT_EQ(filter.ambiguous_rows(1), 0x03);
+    EXPECT_EQ(filter.ambiguous_rows(2), 0x00);
+}
+
+TEST_F(RectangleGhostFilterTest, SuppressesGhostFromCircuitWithoutDiodes) {
+    FakeMatrix circuit(FakeMatrix::WITHOUT_DIODES);
+    circuit.set_closed_switches(vector<pair<int, int> >{ {0, 0}, {2, 0}, {2, 5} });
+    reported = {{0x01, 0x00, 0x01, 0x00}};
+    Columns sampled = read_circuit(circuit);
+    ASSERT_EQ(sampled[0], 0x21);  // Ghost at (0, 5).
+
+    Columns result = when_filtered(sampled);
+
+    EXPECT_EQ(result, Columns({{0x01, 0x00, 0x01, 0x00}}));
+}
+
+TEST_F(RectangleGhostFilterTest, SuppressesGhostAtEndOfChain) {
+    FakeMatrix circuit(FakeMatrix::WITHOUT_DIODES);
+    circuit.set_closed_switches(vector<pair<int, int> >{ {0, 0}, {1, 0}, {1, 1}, {3, 1}, {3, 2}, {2, 7} });
+    reported = {{0x01, 0x03, 0x80, 0x02}};
+
+    Columns result = when_filtered(read_circuit(circuit));
+
+    EXPECT_EQ(result, Columns({{0x01, 0x03, 0x80, 0x02}}));
+}
+
+TEST(NoGhostFilterTest, PassesEverything) {
+    NoGhostFilter::Filter<2, uint8_t> filter;
+    array<uint8_t, 2> sampled = {{0x03, 0x03}};
+
+    filter.filter(sampled, array<uint8_t, 2>());
+
+    EXPECT_EQ(sampled, (array<uint8_t, 2>({{0x03, 0x03}})));
+}
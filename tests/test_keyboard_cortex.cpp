@@ -3,23 +3,28 @@
 #include <algorithm>
 #include <array>
 #include <cstddef>
+#include <cstdlib>
 #include <iostream>
 #include <utility>
 #include <vector>
 #include "Arduino.h"
 #include "gtest/gtest.h"
+#include "fake_keyboard.h"
 #include "keyboard_cortex.h"
+#include "keymap.h"
 
 using namespace std;
 
 
-KeyboardCortex<2, 4, 3> default_cortex = {{{
+constexpr KeyboardCortex<2, 4, 3>::Keymap default_keymap = {{
     {{
         {{ KEY_TAB, KEY_Q, KEY_W, KEY_E }},
         {{ MODIFIERKEY_CTRL, KEY_A, KEY_S, KEY_D }},
         {{ MODIFIERKEY_SHIFT, KEY_Z, KEY_X, KEY_C }},
     }},
-}}};
+}};
+
+KeyboardCortex<2, 4, 3> default_cortex(default_keymap);
 
 class KeyboardContextTest: public ::testing::Test {
 
@@ -105,3 +110,517 @@ TEST_F(KeyboardContextTest, CombinesModifers) {
 
     then_result_should_be(MODIFIERKEY_CTRL | MODIFIERKEY_SHIFT, {{KEY_A}});
 }
+
+
+/**
+ * Test fixture for building records incrementally from events.
+ */
+class IncrementalKeyboardCortexTest: public KeyboardContextTest {
+public:
+    vector<Switch> pressed;
+
+    void given_events(vector<SwitchEvent> events) {
+        for (auto event : events) {
+            cortex.apply(event);
+        }
+    }
+
+    void when_events(vector<SwitchEvent> events) {
+        given_events(events);
+        result = cortex.current_record();
+    }
+
+    // Applies the event and checks the result matches rebuilding from scratch.
+    void when_event_checked(SwitchEvent event) {
+        if (event.is_press) {
+            pressed.push_back(Switch(event.col, event.row));
+        } else {
+            pressed.erase(find(pressed.begin(), pressed.end(), Switch(event.col, event.row)));
+        }
+        cortex.apply(event);
+        keyboard_record expected = cortex.record_from_switches(Switches(pressed.data(), pressed.size()));
+        ASSERT_EQ(cortex.current_record().modifier_flags, expected.modifier_flags);
+        ASSERT_EQ(cortex.current_record().keys, expected.keys);
+    }
+};
+
+
+TEST_F(IncrementalKeyboardCortexTest, StartsEmptyAndClean) {
+    EXPECT_FALSE(cortex.is_dirty());
+    EXPECT_FALSE(cortex.take_record(result));
+}
+
+TEST_F(IncrementalKeyboardCortexTest, AddsKeysAsPressed) {
+    when_events({SwitchEvent(1, 1, true, 0), SwitchEvent(1, 0, true, 1)});
+
+    then_result_should_be(0, {{KEY_A, KEY_Q}});
+    EXPECT_TRUE(cortex.is_dirty());
+}
+
+TEST_F(IncrementalKeyboardCortexTest, RemovesKeysAsReleased) {
+    when_events({SwitchEvent(1, 1, true, 0), SwitchEvent(1, 0, true, 1), SwitchEvent(0, 0, true, 2), SwitchEvent(1, 1, false, 3)});
+
+    then_result_should_be(0, {{KEY_Q, KEY_TAB}});
+}
+
+TEST_F(IncrementalKeyboardCortexTest, ClearsModifierWhenReleased) {
+    when_events({SwitchEvent(0, 1, true, 0), SwitchEvent(0, 2, true, 1), SwitchEvent(0, 1, false, 2)});
+
+    then_result_should_be(MODIFIERKEY_SHIFT, {{}});
+}
+
+TEST_F(IncrementalKeyboardCortexTest, IsCleanOnceRecordTaken) {
+    given_events({SwitchEvent(1, 1, true, 0)});
+
+    EXPECT_TRUE(cortex.take_record(result));
+
+    then_result_should_be(0, {{KEY_A}});
+    EXPECT_FALSE(cortex.is_dirty());
+    EXPECT_FALSE(cortex.take_record(result));
+}
+
+TEST_F(IncrementalKeyboardCortexTest, AddsKeyThatDidNotFitWhenRoomMade) {
+    when_events({
+        SwitchEvent(0, 0, true, 0), SwitchEvent(1, 0, true, 1), SwitchEvent(2, 0, true, 2), SwitchEvent(3, 0, true, 3),
+        SwitchEvent(1, 1, true, 4), SwitchEvent(2, 1, true, 5), SwitchEvent(3, 1, true, 6), SwitchEvent(1, 2, true, 7),
+        SwitchEvent(1, 0, false, 8),
+    });
+
+    then_result_should_be(0, {{KEY_TAB, KEY_W, KEY_E, KEY_A, KEY_S, KEY_D}});
+}
+
+TEST(BigKeyboardCortexTest, AddsKeyBeyondCell256ThatDidNotFitWhenRoomMade) {
+    // 20 columns of 16 rows, with cell n mapped to the nth letter, wrapping round.
+    static KeyboardCortex<1, 20, 16>::Keymap keymap;
+    for (int col = 0; col < 20; ++col) {
+        for (int row = 0; row < 16; ++row) {
+            keymap[0][row][col] = KeymapEntry(KEY_A + (col * 16 + row) % 26);
+        }
+    }
+    KeyboardCortex<1, 20, 16> cortex(keymap);
+    for (int row = 0; row < 6; ++row) {
+        cortex.apply(SwitchEvent(0, row, true, row));
+    }
+
+    cortex.apply(SwitchEvent(17, 0, true, 6));  // Cell 272.
+    cortex.apply(SwitchEvent(0, 0, false, 7));
+
+    const keyboard_record &record = cortex.current_record();
+    EXPECT_EQ(record.keys[0], KEY_B & 0xFF);
+    EXPECT_EQ(record.keys[5], KEY_M & 0xFF);
+}
+
+TEST_F(IncrementalKeyboardCortexTest, MatchesRecordFromSwitches) {
+    srand(1313);
+    vector<pair<int, int> > cells;
+    for (int col = 0; col < column_count; ++col) {
+        for (int row = 0; row < row_count; ++row) {
+            cells.push_back(make_pair(col, row));
+        }
+    }
+    for (int i = 0; i < 2000; ++i) {
+        auto cell = cells[rand() % cells.size()];
+        bool is_pressed = find(pressed.begin(), pressed.end(), Switch(cell.first, cell.second)) != pressed.end();
+        when_event_checked(SwitchEvent(cell.first, cell.second, !is_pressed, i));
+    }
+}
+
+TEST_F(IncrementalKeyboardCortexTest, AppliesEventsFromQueue) {
+    SwitchEvents events;
+    events.push(SwitchEvent(0, 1, true, 0));
+    events.push(SwitchEvent(3, 2, true, 1));
+
+    cortex.apply(events);
+
+    EXPECT_TRUE(events.empty());
+    result = cortex.current_record();
+    then_result_should_be(MODIFIERKEY_CTRL, {{KEY_C}});
+}
+
+
+TEST(KeyboardReportsTest, SendsAllOfReport) {
+    FakeKeyboardTraits keyboard;
+    keyboard_record record(MODIFIERKEY_SHIFT, {{KEY_A & 0xFF, KEY_B & 0xFF, 3, 4, 5, 6}});
+
+    EXPECT_TRUE(keyboard.send_report(record));
+
+    ASSERT_EQ(keyboard.send_count(), 1);
+    EXPECT_EQ(keyboard.sent[0], record);
+}
+
+TEST(KeyboardReportsTest, DoesNotSendSameReportTwice) {
+    FakeKeyboardTraits keyboard;
+    keyboard_record record(MODIFIERKEY_SHIFT, {{KEY_A & 0xFF}});
+    keyboard.send_report(record);
+
+    EXPECT_FALSE(keyboard.send_report(record));
+
+    EXPECT_EQ(keyboard.send_count(), 1);
+}
+
+TEST(KeyboardReportsTest, SendsEmptyReportFirstTime) {
+    FakeKeyboardTraits keyboard;
+
+    EXPECT_TRUE(keyboard.send_report(keyboard_record()));
+
+    EXPECT_EQ(keyboard.send_count(), 1);
+}
+
+TEST_F(IncrementalKeyboardCortexTest, SendsOneReportPerChangeWhenSentEveryScan) {
+    FakeKeyboardTraits keyboard;
+    int change_count = 0;
+
+    for (int millis = 0; millis < 10000; ++millis) {
+        if (millis % 100 == 0) {
+            int col = (millis / 100) % column_count;
+            bool is_press = (millis / 100 / column_count) % 2 == 0;
+            cortex.apply(SwitchEvent(col, 1, is_press, millis));
+            ++change_count;
+        }
+        keyboard.send_report(cortex.current_record());
+    }
+
+    EXPECT_EQ(keyboard.send_count(), change_count);
+}
+
+
+/**
+ * Test fixture for N-key rollover.
+ */
+class NkroKeyboardCortexTest: public ::testing::Test {
+public:
+    KeyboardCortex<2, 4, 3, nkro_record> cortex;
+    nkro_record result;
+
+    NkroKeyboardCortexTest(): cortex(default_keymap) {}
+
+    void then_result_should_have_keys(vector<unsigned> expected_keys) {
+        int count = 0;
+        for (int scancode = 0; scancode < nkro_scancode_count; ++scancode) {
+            bool expected = find(expected_keys.begin(), expected_keys.end(), scancode | 0xF000) != expected_keys.end();
+            EXPECT_EQ(result.has_key(scancode), expected) << "Scancode " << scancode;
+            count += result.has_key(scancode);
+        }
+        EXPECT_EQ(count, expected_keys.size());
+    }
+};
+
+
+TEST_F(NkroKeyboardCortexTest, ReportsMoreThan6Keys) {
+    vector<Switch> switches = {
+        Switch(0, 0), Switch(1, 0), Switch(2, 0), Switch(3, 0),
+        Switch(1, 1), Switch(2, 1), Switch(3, 1), Switch(1, 2),
+    };
+
+    result = cortex.record_from_switches(Switches(switches.data(), switches.size()));
+
+    then_result_should_have_keys({KEY_TAB, KEY_Q, KEY_W, KEY_E, KEY_A, KEY_S, KEY_D, KEY_Z});
+}
+
+TEST_F(NkroKeyboardCortexTest, ReportsModifiers) {
+    vector<Switch> switches = { Switch(0, 1), Switch(0, 2), Switch(2, 2) };
+
+    result = cortex.record_from_switches(Switches(switches.data(), switches.size()));
+
+    EXPECT_EQ(result.modifier_flags, MODIFIERKEY_CTRL | MODIFIERKEY_SHIFT);
+    then_result_should_have_keys({KEY_X});
+}
+
+TEST_F(NkroKeyboardCortexTest, AppliesEventsIncrementally) {
+    for (int col = 0; col < 4; ++col) {
+        cortex.apply(SwitchEvent(col, 0, true, col));
+        cortex.apply(SwitchEvent(col, 2, true, col));
+    }
+    cortex.apply(SwitchEvent(1, 0, false, 10));
+
+    EXPECT_TRUE(cortex.take_record(result));
+    EXPECT_EQ(result.modifier_flags, MODIFIERKEY_SHIFT);
+    then_result_should_have_keys({KEY_TAB, KEY_W, KEY_E, KEY_Z, KEY_X, KEY_C});
+}
+
+TEST(NkroKeyboardCortexDuplicateTest, HoldsKeyUntilLastSwitchWithItReleased) {
+    static constexpr KeyboardCortex<1, 3, 1, nkro_record>::Keymap keymap = {{
+        {{ {{ KEY_Q, KEY_Q, KEY_W }} }},
+    }};
+    KeyboardCortex<1, 3, 1, nkro_record> cortex(keymap);
+    cortex.apply(SwitchEvent(0, 0, true, 0));
+    cortex.apply(SwitchEvent(1, 0, true, 1));
+    cortex.apply(SwitchEvent(2, 0, true, 2));
+
+    cortex.apply(SwitchEvent(2, 0, false, 3));
+    EXPECT_TRUE(cortex.current_record().has_key(KEY_Q & 0xFF));
+    cortex.apply(SwitchEvent(0, 0, false, 4));
+    EXPECT_TRUE(cortex.current_record().has_key(KEY_Q & 0xFF));
+    cortex.apply(SwitchEvent(1, 0, false, 5));
+    EXPECT_FALSE(cortex.current_record().has_key(KEY_Q & 0xFF));
+}
+
+TEST(NkroRecordTest, CoversAllUsageCodes) {
+    nkro_record record;
+
+    for (unsigned code = KEY_A; code <= KEY_F24; ++code) {
+        record.add_key(code & 0xFF);
+    }
+
+    for (unsigned code = KEY_A; code <= KEY_F24; ++code) {
+        EXPECT_TRUE(record.has_key(code & 0xFF));
+    }
+    EXPECT_FALSE(record.has_key((KEY_F24 + 1) & 0xFF));
+}
+
+TEST(NkroRecordTest, LeavesOutCodesBeyondItsBits) {
+    nkro_record record;
+
+    EXPECT_FALSE(record.add_key(nkro_scancode_count));
+    EXPECT_EQ(record, nkro_record());
+    EXPECT_FALSE(record.remove_key(nkro_scancode_count));
+}
+
+TEST(NkroKeyboardCortexRangeTest, DoesNotDirtyRecordForCodeBeyondItsBits) {
+    static constexpr KeyboardCortex<1, 1, 1, nkro_record>::Keymap keymap = {{ {{ {{ KEY_Q }} }} }};
+    KeyboardCortex<1, 1, 1, nkro_record> cortex(keymap);
+    KeymapEntry entry;
+    entry.key_class = KEY_CLASS_REGULAR;
+    entry.code = 0xC8;
+
+    cortex.apply(SwitchEvent(0, 0, true, 0), entry);
+    EXPECT_FALSE(cortex.is_dirty());
+    cortex.apply(SwitchEvent(0, 0, false, 1));
+    EXPECT_FALSE(cortex.is_dirty());
+}
+
+TEST(NkroRecordTest, ComparesEqualOnlyIfSameKeys) {
+    nkro_record a;
+    nkro_record b;
+    a.add_key(KEY_F24 & 0xFF);
+
+    EXPECT_NE(a, b);
+    b.add_key(KEY_F24 & 0xFF);
+    EXPECT_EQ(a, b);
+    EXPECT_TRUE(a.remove_key(KEY_F24 & 0xFF));
+    EXPECT_FALSE(a.remove_key(KEY_F24 & 0xFF));
+    EXPECT_NE(a, b);
+}
+
+TEST_F(KeyboardContextTest, IgnoresMediaKeys) {
+    static constexpr KeyboardCortex<2, 4, 3>::Keymap keymap = {{
+        {{
+            {{ KEY_MEDIA_PLAY_PAUSE, KEY_Q }},
+        }},
+    }};
+    given_spec(KeyboardCortex<2, 4, 3>(keymap));
+
+    when_applied_to_switches({Switch(0, 0), Switch(1, 0)});
+
+    then_result_should_be(0, {{KEY_Q}});
+}
+
+TEST_F(KeyboardContextTest, StartsMacrosInOrderPressed) {
+    static constexpr KeyboardCortex<2, 4, 3>::Keymap keymap = {{
+        {{
+            {{ MACRO_KEY(3), MACRO_KEY(5), KEY_Q }},
+        }},
+    }};
+    given_spec(KeyboardCortex<2, 4, 3>(keymap));
+
+    cortex.apply(SwitchEvent(1, 0, true, 0));
+    cortex.apply(SwitchEvent(0, 0, true, 1));
+    cortex.apply(SwitchEvent(1, 0, false, 2));
+
+    uint8_t number;
+    EXPECT_TRUE(cortex.take_macro(number));
+    EXPECT_EQ(number, 5);
+    EXPECT_TRUE(cortex.take_macro(number));
+    EXPECT_EQ(number, 3);
+    EXPECT_FALSE(cortex.take_macro(number));
+    EXPECT_FALSE(cortex.is_dirty());
+}
+
+
+#define ___ KEY_TRANSPARENT
+
+constexpr KeyboardCortex<3, 4, 3>::Keymap layered_keymap = {{
+    {{
+        {{ KEY_TAB, KEY_Q, KEY_W, LAYER_MOMENTARY(1) }},
+        {{ MODIFIERKEY_CTRL, KEY_A, KEY_S, LAYER_TOGGLE(2) }},
+        {{ MODIFIERKEY_SHIFT, KEY_Z, KEY_X, LAYER_DEFAULT(2) }},
+    }},
+    {{
+        {{ ___, KEY_1, ___, ___ }},
+        {{ ___, KEY_4, ___, ___ }},
+        {{ ___, ___, ___, ___ }},
+    }},
+    {{
+        {{ ___, KEY_F1, KEY_F2, ___ }},
+        {{ ___, ___, ___, ___ }},
+        {{ ___, ___, ___, LAYER_DEFAULT(0) }},
+    }},
+}};
+
+#undef ___
+
+
+/**
+ * Test fixture for a keymap with layers.
+ */
+class LayeredKeyboardCortexTest: public ::testing::Test {
+public:
+    KeyboardCortex<3, 4, 3> cortex;
+    keyboard_record result;
+
+    LayeredKeyboardCortexTest(): cortex(layered_keymap) {}
+
+    void given_tapped(int col, int row) {
+        cortex.apply(SwitchEvent(col, row, true, 0));
+        cortex.apply(SwitchEvent(col, row, false, 0));
+    }
+
+    void when_events(vector<SwitchEvent> events) {
+        for (auto event : events) {
+            cortex.apply(event);
+        }
+        result = cortex.current_record();
+    }
+
+    void then_keys_should_be(array<unsigned, 6> expected_keys) {
+        for (int i = 0; i < 6; ++i) {
+            EXPECT_EQ(result.keys[i], expected_keys[i] & 0xFF) << "Wrong key in position " << i;
+        }
+    }
+};
+
+
+TEST_F(LayeredKeyboardCortexTest, StartsOnLayer0) {
+    EXPECT_EQ(cortex.active_layers(), 0x1);
+    EXPECT_EQ(cortex.lookup(1, 0), KeymapEntry(KEY_Q));
+}
+
+TEST_F(LayeredKeyboardCortexTest, MomentaryLayerIsActiveWhileHeld) {
+    when_events({SwitchEvent(3, 0, true, 0), SwitchEvent(1, 0, true, 1)});
+
+    EXPECT_EQ(cortex.active_layers(), 0x3);
+    then_keys_should_be({{KEY_1}});
+}
+
+TEST_F(LayeredKeyboardCortexTest, MomentaryLayerIsInactiveWhenReleased) {
+    when_events({SwitchEvent(3, 0, true, 0), SwitchEvent(3, 0, false, 1), SwitchEvent(1, 0, true, 2)});
+
+    EXPECT_EQ(cortex.active_layers(), 0x1);
+    then_keys_should_be({{KEY_Q}});
+}
+
+TEST_F(LayeredKeyboardCortexTest, ReleasesKeyPressedOnLayerAfterLayerReleased) {
+    when_events({
+        SwitchEvent(3, 0, true, 0), SwitchEvent(1, 1, true, 1),
+        SwitchEvent(3, 0, false, 2), SwitchEvent(1, 0, true, 3), SwitchEvent(1, 1, false, 4),
+    });
+
+    then_keys_should_be({{KEY_Q}});
+}
+
+TEST_F(LayeredKeyboardCortexTest, TransparentEntryFallsThroughToLayerBelow) {
+    when_events({SwitchEvent(3, 0, true, 0), SwitchEvent(2, 0, true, 1), SwitchEvent(0, 1, true, 2)});
+
+    EXPECT_EQ(result.modifier_flags, MODIFIERKEY_CTRL);
+    then_keys_should_be({{KEY_W}});
+}
+
+TEST_F(LayeredKeyboardCortexTest, ToggleLayerStaysActiveUntilToggledAgain) {
+    given_tapped(3, 1);
+    EXPECT_EQ(cortex.active_layers(), 0x5);
+    EXPECT_EQ(cortex.lookup(2, 0), KeymapEntry(KEY_F2));
+
+    given_tapped(3, 1);
+    EXPECT_EQ(cortex.active_layers(), 0x1);
+    EXPECT_EQ(cortex.lookup(2, 0), KeymapEntry(KEY_W));
+}
+
+TEST_F(LayeredKeyboardCortexTest, HighestActiveLayerWins) {
+    given_tapped(3, 1);
+
+    when_events({SwitchEvent(3, 0, true, 0), SwitchEvent(1, 0, true, 1), SwitchEvent(1, 1, true, 2)});
+
+    then_keys_should_be({{KEY_F1, KEY_4}});
+}
+
+TEST_F(LayeredKeyboardCortexTest, DefaultLayerReplacesBaseLayer) {
+    given_tapped(3, 2);
+    EXPECT_EQ(cortex.active_layers(), 0x4);
+    EXPECT_EQ(cortex.lookup(0, 0), KeymapEntry());
+
+    given_tapped(3, 2);
+    EXPECT_EQ(cortex.active_layers(), 0x1);
+    EXPECT_EQ(cortex.lookup(0, 0), KeymapEntry(KEY_TAB));
+}
+
+TEST_F(LayeredKeyboardCortexTest, IgnoresDefaultLayerThatDoesNotExist) {
+    cortex.set_default_layer(2);
+
+    cortex.set_default_layer(3);
+    cortex.set_default_layer(-1);
+    cortex.set_default_layer(32);
+
+    EXPECT_EQ(cortex.active_layers(), 0x4);
+}
+
+TEST_F(LayeredKeyboardCortexTest, RecordFromSwitchesUsesMomentaryLayersHeld) {
+    vector<Switch> switches = { Switch(1, 0), Switch(3, 0), Switch(1, 1) };
+
+    result = cortex.record_from_switches(Switches(switches.data(), switches.size()));
+
+    then_keys_should_be({{KEY_1, KEY_4}});
+}
+
+TEST_F(LayeredKeyboardCortexTest, RecordFromSwitchesFollowsMomentaryLayersFromOtherLayers) {
+    static constexpr KeyboardCortex<3, 3, 1>::Keymap chained_keymap = {{
+        {{ {{ LAYER_MOMENTARY(1), KEY_A, KEY_B }} }},
+        {{ {{ KEY_TRANSPARENT, LAYER_MOMENTARY(2), KEY_C }} }},
+        {{ {{ KEY_TRANSPARENT, KEY_TRANSPARENT, KEY_D }} }},
+    }};
+    KeyboardCortex<3, 3, 1> chained_cortex(chained_keymap);
+    vector<Switch> switches = { Switch(2, 0), Switch(1, 0), Switch(0, 0) };
+
+    result = chained_cortex.record_from_switches(Switches(switches.data(), switches.size()));
+
+    then_keys_should_be({{KEY_D}});
+}
+
+
+constexpr KeymapOverride layer_1_overrides[] = {
+    {SparseKeymap<3, 4, 3>::cell(1, 0), KEY_1},
+    {SparseKeymap<3, 4, 3>::cell(1, 1), KEY_4},
+};
+
+constexpr KeymapOverride layer_2_overrides[] = {
+    {SparseKeymap<3, 4, 3>::cell(1, 0), KEY_F1},
+    {SparseKeymap<3, 4, 3>::cell(2, 0), KEY_F2},
+    {SparseKeymap<3, 4, 3>::cell(3, 2), LAYER_DEFAULT(0)},
+};
+
+// The same as layered_keymap.
+constexpr SparseKeymap<3, 4, 3> sparse_layered_keymap = {
+    layered_keymap[0],
+    {{ KeymapOverlay(layer_1_overrides), KeymapOverlay(layer_2_overrides) }},
+};
+
+TEST_F(LayeredKeyboardCortexTest, SparseKeymapGivesSameEntries) {
+    KeyboardCortex<3, 4, 3, keyboard_record, SparseKeymap<3, 4, 3> > sparse_cortex(sparse_layered_keymap);
+    vector<SwitchEvent> events = {
+        SwitchEvent(3, 0, true, 0), SwitchEvent(1, 0, true, 1), SwitchEvent(1, 1, true, 2),
+        SwitchEvent(3, 1, true, 3), SwitchEvent(3, 1, false, 4), SwitchEvent(2, 0, true, 5),
+        SwitchEvent(3, 0, false, 6), SwitchEvent(1, 0, false, 7), SwitchEvent(3, 2, true, 8),
+        SwitchEvent(3, 2, false, 9), SwitchEvent(0, 0, true, 10),
+    };
+
+    for (SwitchEvent event : events) {
+        cortex.apply(event);
+        sparse_cortex.apply(event);
+        EXPECT_EQ(sparse_cortex.current_record(), cortex.current_record()) << "After event at " << event.millis;
+        EXPECT_EQ(sparse_cortex.active_layers(), cortex.active_layers());
+        for (int col = 0; col < 4; ++col) {
+            for (int row = 0; row < 3; ++row) {
+                EXPECT_EQ(sparse_cortex.lookup(col, row), cortex.lookup(col, row)) << col << ", " << row;
+            }
+        }
+    }
+}
@@ -6,6 +6,7 @@
 #include <utility>
 #include <vector>
 #include "Arduino.h"
+#include "fake_matrix.h"
 #include "gtest/gtest.h"
 #include "keyboard_matrix.h"
 
@@ -13,35 +14,73 @@ using namespace std;
 
 
 /**
- * Test fixture with a keyboard matrix and some controllable pins.
+ * Pins for the matrix, optionally with the rows on a port.
+ * Separate from the fixture so they are ready before the matrix is created.
  */
-class KeyboardMatrixTest: public ::testing::Test, protected FakePinListener {
-public:
+struct KeyboardMatrixPins {
+    enum RowPort { NO_PORT, PORT_IN_ORDER, PORT_REVERSED };
+
     static const int column_count = 2;
     static const int row_count = 2;
 
-    array<FakePin, column_count> column_pins;
-    array<FakePin, row_count> row_pins;
-    KeyboardMatrix<column_count, row_count, FakePin *, FakePinTraits> keyboard_matrix;
+    FakeMatrix circuit;
+    array<FakeMatrixColumnPin, column_count> column_pins;
+    array<FakeMatrixRowPin, row_count> row_pins;
+    FakePort row_port;
+
+    explicit KeyboardMatrixPins(RowPort row_port_layout) {
+        for (int i = 0; i < column_count; ++i) {
+            column_pins[i].connect(&circuit, i);
+        }
+        for (int j = 0; j < row_count; ++j) {
+            row_pins[j].connect(&circuit, j);
+        }
+        if (row_port_layout == PORT_IN_ORDER) {
+            row_port.add_pin(&row_pins[0]);
+            row_port.add_pin(&row_pins[1]);
+        } else if (row_port_layout == PORT_REVERSED) {
+            row_port.add_pin(&row_pins[1]);
+            row_port.add_pin(&row_pins[0]);
+        }
+    }
+};
+
+const int KeyboardMatrixPins::column_count;
+const int KeyboardMatrixPins::row_count;
+
+
+/**
+ * Test fixture with a keyboard matrix and some controllable pins.
+ */
+template<class Debounce_t, class Instrument_t = NoScanInstrumentation, class Ghost_t = NoGhostFilter>
+class KeyboardMatrixFixture: public ::testing::Test, public KeyboardMatrixPins {
+public:
+    KeyboardMatrix<column_count, row_count, FakePin *, FakePinTraits, Debounce_t, Instrument_t, Ghost_t> keyboard_matrix;
 
-    vector<pair<int, int> > closed_switches;
     millis_t next_millis = 13;
 
-    KeyboardMatrixTest():
+    explicit KeyboardMatrixFixture(RowPort row_port_layout = NO_PORT):
+        KeyboardMatrixPins(row_port_layout),
         keyboard_matrix{ {{&column_pins[0], &column_pins[1]}}, {{&row_pins[0], &row_pins[1]}} }
-    {
+    {}
+
+    void TearDown() override {
         for (auto &pin : column_pins) {
-            pin.add_listener(this);
+            EXPECT_FALSE(pin.has_been_driven_high());
         }
     }
 
+    void given_closed_switches(vector<pair<int, int> > closed_switches) {
+        circuit.set_closed_switches(closed_switches);
+    }
+
     void when_loop_called_with_closed_switches(vector<pair<int, int> > next_closed_switches) {
-        closed_switches = next_closed_switches;
+        circuit.set_closed_switches(next_closed_switches);
         keyboard_matrix.loop(next_millis++);
     }
 
     void when_loop_called_with_closed_switches(millis_t millis, vector<pair<int, int> > next_closed_switches) {
-        closed_switches = next_closed_switches;
+        circuit.set_closed_switches(next_closed_switches);
         next_millis = millis;
         keyboard_matrix.loop(next_millis++);
     }
@@ -50,6 +89,14 @@ public:
         when_loop_called_with_closed_switches(millis, next_closed_switches);
     }
 
+    // Call loop every millisecond up to and including end, with nothing closed.
+    void given_loop_called_each_milli_until(millis_t end) {
+        circuit.set_closed_switches(vector<pair<int, int> >());
+        for (; static_cast<long>(next_millis - end) <= 0; ++next_millis) {
+            keyboard_matrix.loop(next_millis);
+        }
+    }
+
     void then_pressed_switches_should_contain_in_any_order(vector<Switch> expected) {
         Switches actual = keyboard_matrix.pressed_switches();
         for (Switch x : expected) {
@@ -62,37 +109,56 @@ public:
         }
         EXPECT_EQ(actual.size(), expected.size());
     }
+};
 
-protected:
-    void on_value_changed(int) override {
-        update();
+
+typedef KeyboardMatrixFixture<LockoutDebounce<> > KeyboardMatrixTest;
+typedef KeyboardMatrixFixture<VerticalCounterDebounce> VerticalCounterKeyboardMatrixTest;
+typedef KeyboardMatrixFixture<EagerPressDebounce<5> > EagerPressKeyboardMatrixTest;
+
+
+/**
+ * Clock for instrumentation that advances one tick each time it is read,
+ * so a phase's time is how many times the clock was read during it.
+ */
+struct SteppingScanClock {
+    static scan_ticks_t ticks() {
+        static scan_ticks_t value;
+        return ++value;
     }
+};
 
-private:
-    /**
-     * Every time we set the value of a pin
-     * we update the values of pins that are affected by it.
-     */
-    void update() {
-        for (int j = 0; j < row_count; ++j) {
-            int value = HIGH;
-            for (auto pr : closed_switches) {
-                int col = pr.first;
-                int row = pr.second;
-                if (row == j) {
-                    auto &pin = column_pins[col];
-                    if (!pin.is_floating()) {
-                        EXPECT_EQ(pin.get_value(), LOW);
-                        value = LOW;
-                        break;
-                    }
-                }
-            }
-            row_pins[j].set_value(value);
-        }
+typedef KeyboardMatrixFixture<LockoutDebounce<>, ScanInstrumentation<SteppingScanClock> > InstrumentedKeyboardMatrixTest;
+typedef KeyboardMatrixFixture<LockoutDebounce<>, ScanInstrumentation<SteppingScanClock>, RectangleGhostFilter>
+    GhostFilteredInstrumentedKeyboardMatrixTest;
+
+
+/**
+ * Matrix whose switches have no diodes, so three closed corners of a rectangle close the fourth.
+ */
+template<class Ghost_t>
+class DiodelessKeyboardMatrixFixture: public KeyboardMatrixFixture<LockoutDebounce<>, NoScanInstrumentation, Ghost_t> {
+public:
+    DiodelessKeyboardMatrixFixture() {
+        this->circuit.reset(FakeMatrix::WITHOUT_DIODES);
     }
 };
 
+typedef DiodelessKeyboardMatrixFixture<NoGhostFilter> DiodelessKeyboardMatrixTest;
+typedef DiodelessKeyboardMatrixFixture<RectangleGhostFilter> GhostFilteredKeyboardMatrixTest;
+
+
+class KeyboardMatrixPortTest: public KeyboardMatrixTest {
+public:
+    KeyboardMatrixPortTest(): KeyboardMatrixTest(PORT_IN_ORDER) {}
+};
+
+
+class KeyboardMatrixReversedPortTest: public KeyboardMatrixTest {
+public:
+    KeyboardMatrixReversedPortTest(): KeyboardMatrixTest(PORT_REVERSED) {}
+};
+
 
 /* Tests */
 
@@ -107,7 +173,7 @@ TEST_F(KeyboardMatrixTest, StartsWithAllColumnsFloatingAllRowsInputs) {
 }
 
 TEST_F(KeyboardMatrixTest, RecordsKeyPressInLoop) {
-    closed_switches = { {0, 1} };
+    given_closed_switches({ {0, 1} });
 
     keyboard_matrix.loop(13);
     const Switches result = keyboard_matrix.pressed_switches();
@@ -118,7 +184,7 @@ TEST_F(KeyboardMatrixTest, RecordsKeyPressInLoop) {
 }
 
 TEST_F(KeyboardMatrixTest, DoesntRecordKepressesMoreThanOnce) {
-    closed_switches = { {1, 0} };
+    given_closed_switches({ {1, 0} });
 
     keyboard_matrix.loop(13);
     keyboard_matrix.loop(17);
@@ -173,3 +239,570 @@ TEST_F(KeyboardMatrixTest, KeyReleaseIsNotDebouncedForever) {
     then_pressed_switches_should_contain_in_any_order({ {1, 1}, {0, 1} });
 }
 
+TEST_F(KeyboardMatrixTest, RecordsPressedRowsAsBitmaskPerColumn) {
+    when_loop_called_with_closed_switches({ {1, 0}, {1, 1}, {0, 1} });
+
+    EXPECT_EQ(keyboard_matrix.pressed_rows_in_column(0), 0x2);
+    EXPECT_EQ(keyboard_matrix.pressed_rows_in_column(1), 0x3);
+}
+
+TEST_F(KeyboardMatrixTest, KeepsOrderPressedWhenKeyReleased) {
+    const millis_t start = 200;
+    given_loop_called_with_closed_switches(start, { {0, 0} });
+    given_loop_called_with_closed_switches(start + 1, { {0, 0}, {1, 1} });
+    given_loop_called_with_closed_switches(start + 2, { {0, 0}, {1, 1}, {0, 1} });
+
+    when_loop_called_with_closed_switches(start + debounce_millis, { {1, 1}, {0, 1} });
+
+    Switches result = keyboard_matrix.pressed_switches();
+    ASSERT_EQ(result.size(), 2);
+    EXPECT_EQ(result[0], Switch(1, 1));
+    EXPECT_EQ(result[1], Switch(0, 1));
+}
+
+TEST_F(KeyboardMatrixPortTest, ReadsRowsOnSamePortInOneReadPerColumn) {
+    when_loop_called_with_closed_switches({ {1, 1}, {0, 0} });
+
+    then_pressed_switches_should_contain_in_any_order({ {1, 1}, {0, 0} });
+    EXPECT_EQ(row_port.get_read_count(), column_count);
+}
+
+TEST_F(KeyboardMatrixReversedPortTest, ReadsRowsOnSamePortInAnyOrder) {
+    when_loop_called_with_closed_switches({ {1, 1}, {0, 1} });
+
+    then_pressed_switches_should_contain_in_any_order({ {1, 1}, {0, 1} });
+    EXPECT_EQ(row_port.get_read_count(), column_count);
+}
+
+TEST_F(KeyboardMatrixTest, ReadsRowsOneAtATimeWhenNotOnPort) {
+    when_loop_called_with_closed_switches({ {1, 1} });
+
+    then_pressed_switches_should_contain_in_any_order({ {1, 1} });
+    EXPECT_EQ(row_port.get_read_count(), 0);
+}
+TEST_F(KeyboardMatrixTest, GoesIdleWithAllColumnsLowWhenNothingClosed) {
+    when_loop_called_with_closed_switches({});
+
+    EXPECT_TRUE(keyboard_matrix.is_idle());
+    for (auto &pin : column_pins) {
+        EXPECT_FALSE(pin.is_floating());
+        EXPECT_TRUE(pin.is_low());
+    }
+    for (auto &pin : row_pins) {
+        EXPECT_TRUE(pin.has_wake_interrupt());
+    }
+}
+
+TEST_F(KeyboardMatrixTest, StaysBusyWhileSwitchClosed) {
+    when_loop_called_with_closed_switches({ {0, 1} });
+
+    EXPECT_FALSE(keyboard_matrix.is_idle());
+    EXPECT_TRUE(column_pins[0].is_floating());
+    EXPECT_TRUE(column_pins[1].is_floating());
+}
+
+TEST_F(KeyboardMatrixTest, StaysBusyUntilReleaseRecorded) {
+    given_loop_called_with_closed_switches(100, { {0, 1} });
+
+    when_loop_called_with_closed_switches(110, {});
+
+    EXPECT_FALSE(keyboard_matrix.is_idle());
+    then_pressed_switches_should_contain_in_any_order({ {0, 1} });
+}
+
+TEST_F(KeyboardMatrixTest, WakesAndRecordsPressInSameLoop) {
+    given_loop_called_with_closed_switches(100, {});
+
+    when_loop_called_with_closed_switches(101, { {1, 1} });
+
+    EXPECT_FALSE(keyboard_matrix.is_idle());
+    then_pressed_switches_should_contain_in_any_order({ {1, 1} });
+    EXPECT_FALSE(row_pins[0].has_wake_interrupt());
+    EXPECT_FALSE(row_pins[1].has_wake_interrupt());
+}
+
+TEST_F(KeyboardMatrixTest, GoesIdleAgainAfterRelease) {
+    given_loop_called_with_closed_switches(100, { {1, 1} });
+    given_loop_called_with_closed_switches(100 + debounce_millis, {});
+
+    EXPECT_TRUE(keyboard_matrix.is_idle());
+    then_pressed_switches_should_contain_in_any_order({});
+}
+
+TEST_F(KeyboardMatrixPortTest, ReadsRowsOnceWhileIdle) {
+    given_loop_called_with_closed_switches(100, {});
+    int read_count = row_port.get_read_count();
+
+    when_loop_called_with_closed_switches({});
+
+    EXPECT_EQ(row_port.get_read_count(), read_count + 1);
+}
+
+TEST_F(KeyboardMatrixPortTest, OnlyReadsRowsWhenIdleProbeDueAndNoInterruptFires) {
+    keyboard_matrix.set_scan_rate(ScanRate(1, 8, 100));
+    given_loop_called_with_closed_switches(1000, {});
+    given_loop_called_each_milli_until(2000);
+    millis_t due = keyboard_matrix.next_scan_millis();
+    ASSERT_GT(due, 2001u);
+
+    for (millis_t millis = 2001; millis != due + 1; ++millis) {
+        int read_count = row_port.get_read_count();
+        keyboard_matrix.loop(millis);
+        EXPECT_EQ(row_port.get_read_count(), read_count + 1) << "At " << millis;
+        EXPECT_TRUE(keyboard_matrix.is_idle());
+    }
+
+    // Backed off to the next probe without scanning.
+    EXPECT_EQ(keyboard_matrix.next_scan_millis(), due + 8);
+    EXPECT_TRUE(row_pins[0].has_wake_interrupt());
+    EXPECT_TRUE(column_pins[0].is_low());
+}
+
+TEST_F(KeyboardMatrixTest, ScansEveryActivePeriodWhileSwitchClosed) {
+    keyboard_matrix.set_scan_rate(ScanRate(5, 40, 100));
+    given_loop_called_with_closed_switches(100, { {0, 0} });
+    EXPECT_EQ(keyboard_matrix.next_scan_millis(), 105u);
+
+    when_loop_called_with_closed_switches(104, { {0, 0}, {1, 1} });
+    then_pressed_switches_should_contain_in_any_order({ {0, 0} });
+
+    when_loop_called_with_closed_switches(105, { {0, 0}, {1, 1} });
+    then_pressed_switches_should_contain_in_any_order({ {0, 0}, {1, 1} });
+}
+
+TEST_F(KeyboardMatrixTest, BacksOffStepByStepWhenNothingHappens) {
+    keyboard_matrix.set_scan_rate(ScanRate(1, 8, 100));
+    given_loop_called_with_closed_switches(1000, { {0, 0} });
+    given_closed_switches({});
+    vector<millis_t> periods;  // Each period used, when it changed.
+    vector<millis_t> changed_millis;
+
+    millis_t due = keyboard_matrix.next_scan_millis();
+    for (millis_t millis = 1001; millis < 2000; ++millis) {
+        keyboard_matrix.loop(millis);
+        if (keyboard_matrix.next_scan_millis() != due) {
+            due = keyboard_matrix.next_scan_millis();
+            if (periods.empty() || due - millis != periods.back()) {
+                periods.push_back(due - millis);
+                changed_millis.push_back(millis);
+            }
+        }
+    }
+
+    EXPECT_EQ(periods, vector<millis_t>({1, 2, 4, 8}));
+    // Released once the lockout ends at 1050, so the scan at 1049 was the last with anything pressed.
+    EXPECT_EQ(changed_millis, vector<millis_t>({1001, 1149, 1249, 1349}));
+}
+
+TEST_F(KeyboardMatrixTest, ReturnsToActivePeriodOnFirstPress) {
+    keyboard_matrix.set_scan_rate(ScanRate(1, 8, 100));
+    given_loop_called_with_closed_switches(1000, {});
+    given_loop_called_each_milli_until(2000);
+    millis_t due = keyboard_matrix.next_scan_millis();
+
+    when_loop_called_with_closed_switches(due, { {1, 0} });
+
+    then_pressed_switches_should_contain_in_any_order({ {1, 0} });
+    EXPECT_EQ(keyboard_matrix.next_scan_millis(), due + 1);
+}
+
+TEST_F(KeyboardMatrixTest, ScansAtOnceBetweenSlowScansThoughNoInterruptFires) {
+    keyboard_matrix.set_scan_rate(ScanRate(1, 8, 100));
+    given_loop_called_with_closed_switches(1000, {});
+    given_loop_called_each_milli_until(2000);
+    ASSERT_GT(keyboard_matrix.next_scan_millis(), 2001u);
+    ASSERT_TRUE(row_pins[0].has_wake_interrupt());
+
+    when_loop_called_with_closed_switches(2001, { {1, 0} });
+
+    then_pressed_switches_should_contain_in_any_order({ {1, 0} });
+}
+
+TEST_F(KeyboardMatrixTest, PublishesPressesAndReleasesAsEvents) {
+    SwitchEvents published;
+    keyboard_matrix.publish_events(&published);
+    given_loop_called_with_closed_switches(100, { {1, 0} });
+    given_loop_called_with_closed_switches(110, { {1, 0}, {0, 1} });
+    given_loop_called_with_closed_switches(150, { {0, 1} });
+
+    vector<SwitchEvent> events;
+    SwitchEvent event;
+    while (published.pop(event)) {
+        events.push_back(event);
+    }
+
+    EXPECT_EQ(events, vector<SwitchEvent>({
+        SwitchEvent(1, 0, true, 100), SwitchEvent(0, 1, true, 110), SwitchEvent(1, 0, false, 150),
+    }));
+}
+
+TEST_F(KeyboardMatrixTest, PublishesOnlyWhileGivenRing) {
+    SwitchEvents published;
+    given_loop_called_with_closed_switches(100, { {1, 0} });
+    keyboard_matrix.publish_events(&published);
+    given_loop_called_with_closed_switches(150, {});
+    keyboard_matrix.publish_events(nullptr);
+    given_loop_called_with_closed_switches(200, { {1, 0} });
+
+    SwitchEvent event;
+    ASSERT_TRUE(published.pop(event));
+    EXPECT_EQ(event, SwitchEvent(1, 0, false, 150));
+    EXPECT_FALSE(published.pop(event));
+}
+
+TEST_F(KeyboardMatrixTest, CountsEventsNotConsumed) {
+    SwitchEvents published;
+    keyboard_matrix.publish_events(&published);
+    for (int i = 0; i < switch_event_capacity; ++i) {
+        given_loop_called_with_closed_switches(100 + 100 * i, { {1, 1} });
+        given_loop_called_with_closed_switches(150 + 100 * i, {});
+    }
+
+    EXPECT_EQ(published.overflow_count(), switch_event_capacity);
+}
+
+
+TEST_F(InstrumentedKeyboardMatrixTest, CountsScansEdgesAndHeldBackReadings) {
+    const millis_t start = 69;
+    given_loop_called_with_closed_switches(start, { {1, 1}, {0, 1} });
+    given_loop_called_with_closed_switches(start + 1, { {0, 1} });  // Bounce held back.
+    given_loop_called_with_closed_switches(start + debounce_millis, { {0, 1} });
+
+    ScanStats stats = keyboard_matrix.instrumentation().snapshot();
+    EXPECT_EQ(3u, stats.scans);
+    EXPECT_EQ(3u, stats.edges);
+    EXPECT_EQ(1u, stats.held_back_readings);
+}
+
+TEST_F(InstrumentedKeyboardMatrixTest, TimesEachPhaseOfScan) {
+    when_loop_called_with_closed_switches({});
+
+    // Per column: strobe, read, strobe, debounce; nothing to record.
+    ScanStats stats = keyboard_matrix.instrumentation().snapshot();
+    EXPECT_EQ(1u, stats.scan_ticks.counts[ScanHistogram::bucket_for(2 * 4 + 1)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_STROBE].counts[ScanHistogram::bucket_for(2 * 2)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_READ].counts[ScanHistogram::bucket_for(2)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_GHOST_FILTER].counts[0]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_DEBOUNCE].counts[ScanHistogram::bucket_for(2)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_RECORD].counts[0]);
+}
+
+TEST_F(GhostFilteredInstrumentedKeyboardMatrixTest, TimesGhostFilterApartFromDebounce) {
+    when_loop_called_with_closed_switches({});
+
+    // Strobe, read and strobe per column; then filter once, then debounce per column.
+    ScanStats stats = keyboard_matrix.instrumentation().snapshot();
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_STROBE].counts[ScanHistogram::bucket_for(2 * 2)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_READ].counts[ScanHistogram::bucket_for(2)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_GHOST_FILTER].counts[ScanHistogram::bucket_for(1)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_DEBOUNCE].counts[ScanHistogram::bucket_for(2)]);
+}
+
+TEST_F(InstrumentedKeyboardMatrixTest, GroupsScansByKeysHeld) {
+    when_loop_called_with_closed_switches({});
+    when_loop_called_with_closed_switches({ {0, 0}, {1, 1} });
+
+    ScanStats stats = keyboard_matrix.instrumentation().snapshot();
+    EXPECT_EQ(1u, stats.held_scans[0]);
+    EXPECT_EQ(1u, stats.held_scans[2]);
+    EXPECT_EQ(9u, stats.held_ticks[0]);
+    EXPECT_GT(stats.held_ticks[2], stats.held_ticks[0]);
+
+    keyboard_matrix.instrumentation().reset();
+    EXPECT_EQ(0u, keyboard_matrix.instrumentation().snapshot().scans);
+}
+
+TEST(NoScanInstrumentationTest, TakesNoSpace) {
+    EXPECT_TRUE(std::is_empty<NoScanInstrumentation>::value);
+    EXPECT_TRUE(std::is_empty<NoScanInstrumentation::mark_t>::value);
+}
+
+TEST_F(DiodelessKeyboardMatrixTest, RecordsGhostWithoutFilter) {
+    given_loop_called_with_closed_switches(100, { {0, 0}, {1, 0} });
+
+    when_loop_called_with_closed_switches(200, { {0, 0}, {1, 0}, {1, 1} });
+
+    then_pressed_switches_should_contain_in_any_order({ {0, 0}, {1, 0}, {1, 1}, {0, 1} });
+}
+
+TEST_F(GhostFilteredKeyboardMatrixTest, HoldsBackPressesThatCouldBeGhosts) {
+    given_loop_called_with_closed_switches(100, { {0, 0}, {1, 0} });
+
+    when_loop_called_with_closed_switches(200, { {0, 0}, {1, 0}, {1, 1} });
+
+    then_pressed_switches_should_contain_in_any_order({ {0, 0}, {1, 0} });
+}
+
+TEST_F(GhostFilteredKeyboardMatrixTest, RecordsHeldBackPressOnceAmbiguityClears) {
+    given_loop_called_with_closed_switches(100, { {0, 0}, {1, 0} });
+    given_loop_called_with_closed_switches(200, { {0, 0}, {1, 0}, {1, 1} });
+
+    when_loop_called_with_closed_switches(300, { {0, 0}, {1, 1} });
+
+    then_pressed_switches_should_contain_in_any_order({ {0, 0}, {1, 1} });
+}
+
+TEST_F(GhostFilteredKeyboardMatrixTest, IgnoresRectangleClosedAtOnceUntilItClears) {
+    when_loop_called_with_closed_switches(100, { {0, 0}, {1, 0}, {0, 1} });
+
+    then_pressed_switches_should_contain_in_any_order({});
+
+    when_loop_called_with_closed_switches(200, { {0, 0}, {1, 1} });
+
+    then_pressed_switches_should_contain_in_any_order({ {0, 0}, {1, 1} });
+}
+
+TEST_F(VerticalCounterKeyboardMatrixTest, IgnoresSwitchClosedForFewerThanFourScans) {
+    given_loop_called_with_closed_switches(100, { {1, 0} });
+    given_loop_called_with_closed_switches(101, { {1, 0} });
+    given_loop_called_with_closed_switches(102, { {1, 0} });
+
+    when_loop_called_with_closed_switches(103, {});
+
+    then_pressed_switches_should_contain_in_any_order({});
+}
+
+TEST_F(VerticalCounterKeyboardMatrixTest, RecordsSwitchClosedForFourScans) {
+    given_loop_called_with_closed_switches(100, { {1, 0} });
+    given_loop_called_with_closed_switches(101, { {1, 0} });
+    given_loop_called_with_closed_switches(102, { {1, 0}, {0, 1} });
+
+    when_loop_called_with_closed_switches(103, { {1, 0}, {0, 1} });
+
+    then_pressed_switches_should_contain_in_any_order({ {1, 0} });
+}
+
+TEST_F(EagerPressKeyboardMatrixTest, RecordsQuickRepress) {
+    given_loop_called_with_closed_switches(100, { {1, 0} });
+    given_loop_called_with_closed_switches(110, {});
+    given_loop_called_with_closed_switches(115, {});
+
+    when_loop_called_with_closed_switches(120, { {1, 0} });
+
+    then_pressed_switches_should_contain_in_any_order({ {1, 0} });
+}
+
+TEST_F(EagerPressKeyboardMatrixTest, DefersRelease) {
+    given_loop_called_with_closed_switches(100, { {1, 0} });
+
+    when_loop_called_with_closed_switches(110, {});
+
+    then_pressed_switches_should_contain_in_any_order({ {1, 0} });
+}
+
+
+/**
+ * Pins for a matrix with pin numbers fixed at compile time.
+ * The fake traits look them up by number, so they are bound before the matrix is created.
+ */
+struct StaticKeyboardMatrixPins {
+    typedef StaticMatrixPinTraits<PinList<2, 3>, PinList<5, 6>, FakeFastPinTraits> Traits;
+
+    FakeMatrix circuit;
+    array<FakeMatrixColumnPin, 2> column_pins;
+    array<FakeMatrixRowPin, 2> row_pins;
+
+    StaticKeyboardMatrixPins() {
+        for (int i = 0; i < 2; ++i) {
+            column_pins[i].connect(&circuit, i);
+            row_pins[i].connect(&circuit, i);
+        }
+        FakeFastPinTraits::reset();
+        FakeFastPinTraits::pins()[2] = &column_pins[0];
+        FakeFastPinTraits::pins()[3] = &column_pins[1];
+        FakeFastPinTraits::pins()[5] = &row_pins[0];
+        FakeFastPinTraits::pins()[6] = &row_pins[1];
+    }
+};
+
+
+class StaticKeyboardMatrixTest: public ::testing::Test, public StaticKeyboardMatrixPins {
+public:
+    KeyboardMatrix<2, 2, int, Traits> keyboard_matrix;
+
+    void given_closed_switches(vector<pair<int, int> > closed_switches) {
+        circuit.set_closed_switches(closed_switches);
+    }
+};
+
+
+TEST_F(StaticKeyboardMatrixTest, StartsWithColumnsOpenDrainFloatingAndRowsPulledUp) {
+    vector<FakePinOperation> expected = {
+        {FakePinOperation::PIN_MODE, 2, OUTPUT_OPENDRAIN}, {FakePinOperation::WRITE, 2, HIGH},
+        {FakePinOperation::PIN_MODE, 3, OUTPUT_OPENDRAIN}, {FakePinOperation::WRITE, 3, HIGH},
+        {FakePinOperation::PIN_MODE, 5, INPUT_PULLUP},
+        {FakePinOperation::PIN_MODE, 6, INPUT_PULLUP},
+    };
+    EXPECT_EQ(FakeFastPinTraits::operations(), expected);
+    EXPECT_TRUE(column_pins[0].is_floating());
+    EXPECT_TRUE(column_pins[1].is_floating());
+}
+
+TEST_F(StaticKeyboardMatrixTest, StrobesColumnsWithWritesAlone) {
+    given_closed_switches({ {1, 0} });
+    FakeFastPinTraits::operations().clear();
+
+    keyboard_matrix.loop(13);
+
+    vector<FakePinOperation> expected = {
+        {FakePinOperation::WRITE, 2, LOW},
+        {FakePinOperation::READ, 5, HIGH}, {FakePinOperation::READ, 6, HIGH},
+        {FakePinOperation::WRITE, 2, HIGH},
+        {FakePinOperation::WRITE, 3, LOW},
+        {FakePinOperation::READ, 5, LOW}, {FakePinOperation::READ, 6, HIGH},
+        {FakePinOperation::WRITE, 3, HIGH},
+    };
+    EXPECT_EQ(FakeFastPinTraits::operations(), expected);
+}
+
+TEST_F(StaticKeyboardMatrixTest, RecordsKeyPresses) {
+    given_closed_switches({ {1, 0}, {0, 1} });
+
+    keyboard_matrix.loop(13);
+
+    Switches result = keyboard_matrix.pressed_switches();
+    ASSERT_EQ(result.size(), 2);
+    EXPECT_EQ(result[0], Switch(0, 1));
+    EXPECT_EQ(result[1], Switch(1, 0));
+}
+
+TEST_F(StaticKeyboardMatrixTest, FiltersGhostsWithPinsFixed) {
+    KeyboardMatrix<2, 2, int, Traits, LockoutDebounce<>, NoScanInstrumentation, RectangleGhostFilter> filtered_matrix;
+    circuit.reset(FakeMatrix::WITHOUT_DIODES);
+    given_closed_switches({ {0, 0}, {1, 0}, {1, 1} });
+
+    filtered_matrix.loop(13);
+
+    EXPECT_TRUE(filtered_matrix.pressed_switches().empty());
+}
+
+
+TEST_F(StaticKeyboardMatrixTest, OnlyReadsRowsWhileIdle) {
+    keyboard_matrix.loop(13);
+    FakeFastPinTraits::operations().clear();
+
+    keyboard_matrix.loop(14);
+
+    vector<FakePinOperation> expected = {
+        {FakePinOperation::READ, 5, HIGH}, {FakePinOperation::READ, 6, HIGH},
+    };
+    EXPECT_EQ(FakeFastPinTraits::operations(), expected);
+    EXPECT_FALSE(column_pins[0].is_floating());
+    EXPECT_FALSE(column_pins[1].is_floating());
+}
+
+TEST_F(StaticKeyboardMatrixTest, WakesByLettingColumnsFloatThenScanning) {
+    keyboard_matrix.loop(13);
+    given_closed_switches({ {1, 0} });
+    FakeFastPinTraits::operations().clear();
+
+    keyboard_matrix.loop(14);
+
+    vector<FakePinOperation> expected = {
+        {FakePinOperation::READ, 5, LOW}, {FakePinOperation::READ, 6, HIGH},
+        {FakePinOperation::WRITE, 2, HIGH}, {FakePinOperation::WRITE, 3, HIGH},
+        {FakePinOperation::WRITE, 2, LOW},
+        {FakePinOperation::READ, 5, HIGH}, {FakePinOperation::READ, 6, HIGH},
+        {FakePinOperation::WRITE, 2, HIGH},
+        {FakePinOperation::WRITE, 3, LOW},
+        {FakePinOperation::READ, 5, LOW}, {FakePinOperation::READ, 6, HIGH},
+        {FakePinOperation::WRITE, 3, HIGH},
+    };
+    EXPECT_EQ(FakeFastPinTraits::operations(), expected);
+    EXPECT_EQ(keyboard_matrix.pressed_rows_in_column(1), 0x1);
+}
+
+TEST_F(StaticKeyboardMatrixTest, SeesFirstPressBetweenSlowScansWithoutWakeInterrupt) {
+    keyboard_matrix.set_scan_rate(ScanRate(1, 8, 100));
+    for (millis_t millis = 1000; millis < 2000; ++millis) {
+        keyboard_matrix.loop(millis);
+    }
+    millis_t due = keyboard_matrix.next_scan_millis();
+    ASSERT_GT(due, 2001u);
+
+    given_closed_switches({ {1, 0} });
+    keyboard_matrix.loop(2001);
+
+    EXPECT_EQ(keyboard_matrix.pressed_rows_in_column(1), 0x1);
+    EXPECT_EQ(keyboard_matrix.next_scan_millis(), 2002u);
+}
+
+TEST_F(StaticKeyboardMatrixTest, KeepsBackingOffWhileRowsReadOpen) {
+    keyboard_matrix.set_scan_rate(ScanRate(1, 8, 100));
+    for (millis_t millis = 1000; millis < 2000; ++millis) {
+        keyboard_matrix.loop(millis);
+    }
+    millis_t due = keyboard_matrix.next_scan_millis();
+
+    keyboard_matrix.loop(2001);
+
+    EXPECT_EQ(keyboard_matrix.next_scan_millis(), due);
+}
+
+
+TEST(FakeMatrixTest, WithDiodesPullsDownOnlyRowsOfDrivenColumn) {
+    FakeMatrix circuit;
+    circuit.set_closed_switches(vector<pair<int, int> >{ {0, 0}, {1, 0}, {1, 1} });
+
+    circuit.drive_column(0, true);
+
+    EXPECT_EQ(circuit.rows_low(), 0x1u);
+    EXPECT_TRUE(circuit.is_row_low(0));
+    EXPECT_FALSE(circuit.is_row_low(1));
+}
+
+TEST(FakeMatrixTest, WithoutDiodesThreeCornersGhostTheFourth) {
+    FakeMatrix circuit(FakeMatrix::WITHOUT_DIODES);
+    circuit.set_closed_switches(vector<pair<int, int> >{ {0, 0}, {1, 0}, {1, 1} });
+
+    circuit.drive_column(0, true);
+
+    EXPECT_EQ(circuit.rows_low(), 0x3u);
+}
+
+TEST(FakeMatrixTest, WithoutDiodesFollowsChainsOfClosedSwitches) {
+    FakeMatrix circuit(FakeMatrix::WITHOUT_DIODES);
+    circuit.set_closed_switches(vector<pair<int, int> >{ {0, 0}, {3, 0}, {3, 2}, {5, 2}, {5, 7}, {6, 4} });
+
+    circuit.drive_column(0, true);
+
+    EXPECT_EQ(circuit.rows_low(), 0x85u);
+}
+
+TEST(FakeMatrixTest, RowsFloatUpWhenColumnReleased) {
+    FakeMatrix circuit;
+    circuit.set_closed(2, 3, true);
+    circuit.drive_column(2, true);
+    ASSERT_TRUE(circuit.is_row_low(3));
+
+    circuit.drive_column(2, false);
+
+    EXPECT_EQ(circuit.rows_low(), 0u);
+}
+
+TEST(FakeMatrixTest, NumberedPinsDriveSharedMatrix) {
+    typedef FakeMatrixPinTraits Pins;
+    Pins::reset();
+    Pins::matrix().set_closed(1, 2, true);
+    KeyboardMatrix<3, 4, int, Pins> matrix(Pins::column_pins<3>(), Pins::row_pins<4>());
+
+    matrix.loop(13);
+
+    EXPECT_EQ(matrix.pressed_rows_in_column(1), 0x4);
+    EXPECT_EQ(Pins::matrix().driven_columns(), 0u);
+}
+
+TEST(FakeMatrixTest, NumberedPinsWakeIdleMatrix) {
+    typedef FakeMatrixPinTraits Pins;
+    Pins::reset();
+    KeyboardMatrix<3, 4, int, Pins> matrix(Pins::column_pins<3>(), Pins::row_pins<4>());
+    matrix.loop(13);
+    ASSERT_TRUE(matrix.is_idle());
+    EXPECT_EQ(Pins::matrix().driven_columns(), 0x7u);
+
+    Pins::matrix().set_closed(2, 3, true);
+    matrix.loop(14);
+
+    EXPECT_FALSE(matrix.is_idle());
+    EXPECT_EQ(matrix.pressed_rows_in_column(2), 0x8);
+}
@@ -0,0 +1,113 @@
+/* Tests for keymap. */
+
+#include <stdexcept>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "keymap.h"
+
+
+// Classified when compiled; changing a code to, say, 0x1234 stops this compiling.
+constexpr Keymap<1, 3, 1> keymap = {{
+    {{
+        {{ KEY_A, MODIFIERKEY_RIGHT_ALT, KEY_MEDIA_MUTE }},
+    }},
+}};
+
+static_assert(keymap[0][0][0].key_class == KEY_CLASS_REGULAR, "KEY_A is regular");
+static_assert(keymap[0][0][1].code == 0x40, "Right Alt is modifier bit 6");
+
+
+TEST(KeymapEntryTest, ClassifiesRegularKeys) {
+    EXPECT_EQ(KeymapEntry(KEY_A).key_class, KEY_CLASS_REGULAR);
+    EXPECT_EQ(KeymapEntry(KEY_A).code, 0x04);
+    EXPECT_EQ(KeymapEntry(KEY_F24).key_class, KEY_CLASS_REGULAR);
+    EXPECT_EQ(KeymapEntry(KEY_F24).code, 0x73);
+}
+
+TEST(KeymapEntryTest, ClassifiesModifiers) {
+    EXPECT_EQ(KeymapEntry(MODIFIERKEY_SHIFT).key_class, KEY_CLASS_MODIFIER);
+    EXPECT_EQ(KeymapEntry(MODIFIERKEY_SHIFT).code, 0x02);
+}
+
+TEST(KeymapEntryTest, ClassifiesMediaAndSystemKeys) {
+    EXPECT_EQ(KeymapEntry(KEY_MEDIA_VOLUME_INC).key_class, KEY_CLASS_MEDIA);
+    EXPECT_EQ(KeymapEntry(KEY_SYSTEM_SLEEP).key_class, KEY_CLASS_SYSTEM);
+}
+
+TEST(KeymapEntryTest, ClassifiesLayerActions) {
+    EXPECT_EQ(KeymapEntry(LAYER_MOMENTARY(1)).key_class, KEY_CLASS_LAYER);
+    EXPECT_EQ(KeymapEntry(LAYER_TOGGLE(2)).code, LAYER_ACTION_TOGGLE | 2);
+    EXPECT_EQ(KeymapEntry(LAYER_DEFAULT(3)).code, LAYER_ACTION_DEFAULT | 3);
+    EXPECT_THROW(KeymapEntry(KEY_LAYER_ACTION | 0x60), std::out_of_range);
+}
+
+TEST(KeymapEntryTest, ClassifiesTransparent) {
+    EXPECT_EQ(KeymapEntry(KEY_TRANSPARENT).key_class, KEY_CLASS_TRANSPARENT);
+}
+
+TEST(KeymapEntryTest, ClassifiesMacros) {
+    EXPECT_EQ(KeymapEntry(MACRO_KEY(0)).key_class, KEY_CLASS_MACRO);
+    EXPECT_EQ(KeymapEntry(MACRO_KEY(42)).code, 42);
+}
+
+TEST(KeymapEntryTest, ZeroIsNoKey) {
+    EXPECT_EQ(KeymapEntry(0).key_class, KEY_CLASS_NONE);
+    EXPECT_EQ(KeymapEntry(), KeymapEntry(0));
+}
+
+TEST(KeymapEntryTest, RejectsCodesOutOfRange) {
+    EXPECT_THROW(KeymapEntry(0x1234), std::out_of_range);
+    EXPECT_THROW(KeymapEntry(0xF000), std::out_of_range);
+    EXPECT_THROW(KeymapEntry(0xF000 | 0x74), std::out_of_range);
+}
+
+TEST(KeymapTest, UnlistedEntriesAreNoKey) {
+    EXPECT_EQ(keymap[0][0][2].key_class, KEY_CLASS_MEDIA);
+    Keymap<2, 2, 1> sparse = {{ {{ {{ KEY_A }} }} }};
+    EXPECT_EQ(sparse[0][0][1].key_class, KEY_CLASS_NONE);
+    EXPECT_EQ(sparse[1][0][0].key_class, KEY_CLASS_NONE);
+}
+
+
+constexpr KeymapOverride fn_overrides[] = {
+    {SparseKeymap<3, 3, 2>::cell(0, 1), KEY_F1},
+    {SparseKeymap<3, 3, 2>::cell(2, 0), LAYER_MOMENTARY(2)},
+    {SparseKeymap<3, 3, 2>::cell(2, 1), 0},
+};
+
+constexpr SparseKeymap<3, 3, 2> sparse_keymap = {
+    {{
+        {{ KEY_A, KEY_B, KEY_C }},
+        {{ KEY_D, KEY_E, KEY_F }},
+    }},
+    {{ KeymapOverlay(fn_overrides), KeymapOverlay() }},
+};
+
+TEST(SparseKeymapTest, BaseLayerIsStoredInFull) {
+    EXPECT_EQ(keymap_entry(sparse_keymap, 0, 0, 0), KeymapEntry(KEY_A));
+    EXPECT_EQ(keymap_entry(sparse_keymap, 0, 2, 1), KeymapEntry(KEY_F));
+}
+
+TEST(SparseKeymapTest, FindsOverrides) {
+    EXPECT_EQ(keymap_entry(sparse_keymap, 1, 0, 1), KeymapEntry(KEY_F1));
+    EXPECT_EQ(keymap_entry(sparse_keymap, 1, 2, 0), KeymapEntry(LAYER_MOMENTARY(2)));
+    EXPECT_EQ(keymap_entry(sparse_keymap, 1, 2, 1), KeymapEntry());
+}
+
+TEST(SparseKeymapTest, EntriesNotOverriddenAreTransparent) {
+    EXPECT_EQ(keymap_entry(sparse_keymap, 1, 0, 0), KeymapEntry(KEY_TRANSPARENT));
+    EXPECT_EQ(keymap_entry(sparse_keymap, 1, 1, 1), KeymapEntry(KEY_TRANSPARENT));
+    EXPECT_EQ(keymap_entry(sparse_keymap, 2, 0, 1), KeymapEntry(KEY_TRANSPARENT));
+}
+
+TEST(SparseKeymapTest, RejectsOverridesOutOfOrder) {
+    static const KeymapOverride out_of_order[] = { {3, KEY_A}, {1, KEY_B} };
+
+    EXPECT_THROW(KeymapOverlay overlay(out_of_order), std::invalid_argument);
+}
+
+TEST(SparseKeymapTest, IsSmallerThanDenseKeymapForFewOverrides) {
+    size_t sparse_size = sizeof(SparseKeymap<10, 18, 6>) + 20 * sizeof(KeymapOverride);
+
+    EXPECT_LT(sparse_size * 4, sizeof(Keymap<10, 18, 6>));
+}
@@ -0,0 +1,183 @@
+/* Tests for macro. */
+
+#include <array>
+#include <stdexcept>
+#include <vector>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "fake_keyboard.h"
+#include "keyboard_cortex.h"
+#include "macro.h"
+
+using namespace std;
+
+
+constexpr uint8_t tap_a[] = { MACRO_TAP(KEY_A), MACRO_END };
+constexpr uint8_t hi[] = {
+    MACRO_MODIFIERS(MODIFIERKEY_SHIFT), MACRO_TAP(KEY_H), MACRO_MODIFIERS(0), MACRO_TAP(KEY_I), MACRO_END
+};
+
+
+/**
+ * Test fixture with a player sending to a fake keyboard.
+ */
+class MacroPlayerTest: public ::testing::Test {
+public:
+    MacroPlayer player;
+    FakeKeyboardTraits keyboard;
+    millis_t millis;
+    vector<millis_t> sent_millis;  // When each report was sent.
+
+    MacroPlayerTest(): player(), keyboard(), millis(0) {}
+
+    void given_player(millis_t report_interval) {
+        player = MacroPlayer(report_interval);
+    }
+
+    void when_played_until(const uint8_t *macro, millis_t end) {
+        EXPECT_TRUE(player.play(macro, millis));
+        when_looped_until(end);
+    }
+
+    void when_looped_until(millis_t end) {
+        for (; static_cast<long>(end - millis) > 0; ++millis) {
+            size_t before = keyboard.send_count();
+            player.loop(millis, keyboard);
+            if (keyboard.send_count() != before) {
+                sent_millis.push_back(millis);
+            }
+        }
+    }
+
+    void then_sent(vector<keyboard_record> expected) {
+        ASSERT_EQ(keyboard.sent.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            EXPECT_EQ(keyboard.sent[i].modifier_flags, expected[i].modifier_flags) << "Report " << i;
+            EXPECT_EQ(keyboard.sent[i].keys, expected[i].keys) << "Report " << i;
+        }
+    }
+
+    static keyboard_record report(modifier_flags_t flags, array<scancode_t, 6> keys = {}) {
+        return keyboard_record(flags, keys);
+    }
+};
+
+
+TEST_F(MacroPlayerTest, TapsKeyWithTwoReports) {
+    when_played_until(tap_a, 10);
+
+    then_sent({report(0, {{KEY_A & 0xFF}}), report(0)});
+    EXPECT_FALSE(player.is_playing());
+}
+
+TEST_F(MacroPlayerTest, SendsOneReportPerFrame) {
+    when_played_until(hi, 10);
+
+    then_sent({
+        report(MODIFIERKEY_SHIFT), report(MODIFIERKEY_SHIFT, {{KEY_H & 0xFF}}), report(MODIFIERKEY_SHIFT),
+        report(0), report(0, {{KEY_I & 0xFF}}), report(0),
+    });
+    EXPECT_EQ(sent_millis, vector<millis_t>({0, 1, 2, 3, 4, 5}));
+}
+
+TEST_F(MacroPlayerTest, IsPlayingUntilIntervalAfterLastReport) {
+    player.play(tap_a, 0);
+
+    when_looped_until(2);
+    EXPECT_TRUE(player.is_playing());
+    when_looped_until(3);
+    EXPECT_FALSE(player.is_playing());
+}
+
+TEST_F(MacroPlayerTest, KeepsToReportInterval) {
+    given_player(8);
+
+    when_played_until(hi, 100);
+
+    EXPECT_EQ(sent_millis, vector<millis_t>({0, 8, 16, 24, 32, 40}));
+}
+
+TEST_F(MacroPlayerTest, WaitsForDelay) {
+    static constexpr uint8_t macro[] = { MACRO_TAP(KEY_A), MACRO_DELAY(10), MACRO_TAP(KEY_B), MACRO_END };
+
+    when_played_until(macro, 100);
+
+    EXPECT_EQ(sent_millis, vector<millis_t>({0, 1, 12, 13}));
+}
+
+TEST_F(MacroPlayerTest, HoldsPressedKeysUntilReleased) {
+    static constexpr uint8_t macro[] = {
+        MACRO_PRESS(KEY_A), MACRO_PRESS(KEY_B), MACRO_RELEASE(KEY_A), MACRO_RELEASE(KEY_B), MACRO_END
+    };
+
+    when_played_until(macro, 10);
+
+    then_sent({
+        report(0, {{KEY_A & 0xFF}}), report(0, {{KEY_A & 0xFF, KEY_B & 0xFF}}),
+        report(0, {{KEY_B & 0xFF}}), report(0),
+    });
+}
+
+TEST_F(MacroPlayerTest, ReleasesEverythingAtEnd) {
+    static constexpr uint8_t macro[] = { MACRO_PRESS(KEY_A), MACRO_MODIFIERS(MODIFIERKEY_CTRL), MACRO_END };
+
+    when_played_until(macro, 10);
+
+    then_sent({report(0, {{KEY_A & 0xFF}}), report(MODIFIERKEY_CTRL, {{KEY_A & 0xFF}}), report(0)});
+}
+
+TEST_F(MacroPlayerTest, TapsSameKeyTwice) {
+    static constexpr uint8_t macro[] = { MACRO_TAP(KEY_L), MACRO_TAP(KEY_L), MACRO_END };
+
+    when_played_until(macro, 10);
+
+    then_sent({report(0, {{KEY_L & 0xFF}}), report(0), report(0, {{KEY_L & 0xFF}}), report(0)});
+}
+
+TEST_F(MacroPlayerTest, DoesNotStartAnotherWhilePlaying) {
+    EXPECT_TRUE(player.play(tap_a, 0));
+
+    EXPECT_FALSE(player.play(hi, 0));
+}
+
+TEST(MacroTest, OnlyRegularKeysAreScancodes) {
+    EXPECT_EQ(macro_scancode(KEY_Z), KEY_Z & 0xFF);
+    EXPECT_THROW(macro_scancode(MODIFIERKEY_SHIFT), std::out_of_range);
+    EXPECT_THROW(macro_scancode(MACRO_KEY(1)), std::out_of_range);
+}
+
+
+constexpr KeyboardCortex<1, 2, 1>::Keymap macro_keymap = {{
+    {{
+        {{ KEY_Q, MACRO_KEY(0) }},
+    }},
+}};
+
+TEST(MacroCortexTest, ReturnsToCortexRecordWhenMacroEnds) {
+    const uint8_t *macros[] = { tap_a };
+    KeyboardCortex<1, 2, 1> cortex(macro_keymap);
+    MacroPlayer player;
+    FakeKeyboardTraits keyboard;
+
+    cortex.apply(SwitchEvent(0, 0, true, 0));
+    for (millis_t millis = 0; millis < 10; ++millis) {
+        if (millis == 2) {
+            cortex.apply(SwitchEvent(1, 0, true, millis));
+        }
+        player.loop(millis, keyboard);
+        if (!player.is_playing()) {
+            uint8_t number;
+            if (cortex.take_macro(number)) {
+                player.play(macros[number], millis);
+            } else {
+                keyboard.send_report(cortex.current_record());
+            }
+        }
+    }
+
+    ASSERT_EQ(keyboard.send_count(), 4u);
+    EXPECT_EQ(keyboard.sent[0].keys[0], KEY_Q & 0xFF);
+    EXPECT_EQ(keyboard.sent[1].keys[0], KEY_A & 0xFF);
+    EXPECT_EQ(keyboard.sent[2].keys[0], 0);
+    EXPECT_EQ(keyboard.sent[3].keys[0], KEY_Q & 0xFF);
+}
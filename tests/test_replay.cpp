@@ -0,0 +1,174 @@
+/* Tests for replay. */
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "Keyboard.h"
+#include "replay.h"
+#include "switch_trace.h"
+
+using namespace std;
+
+
+string trace_of(int column_count, int row_count, vector<SwitchTraceEntry> entries) {
+    ostringstream out;
+    SwitchTraceWriter writer(out, column_count, row_count);
+    for (const SwitchTraceEntry &entry : entries) {
+        writer.write(entry);
+    }
+    return out.str();
+}
+
+
+TEST(SwitchTraceTest, ReadsBackWhatWasWritten) {
+    vector<SwitchTraceEntry> entries = {
+        SwitchTraceEntry(5, 0, 1, true),
+        SwitchTraceEntry(5, 2, 0, true),  // Same time.
+        SwitchTraceEntry(300, 0, 1, false),  // Delta takes 2 bytes.
+        SwitchTraceEntry(10000000, 2, 0, false),
+    };
+    istringstream in(trace_of(3, 2, entries));
+
+    SwitchTraceReader reader(in);
+    EXPECT_EQ(3, reader.column_count());
+    EXPECT_EQ(2, reader.row_count());
+    vector<SwitchTraceEntry> actual;
+    SwitchTraceEntry entry;
+    while (reader.next(entry)) {
+        actual.push_back(entry);
+    }
+    EXPECT_EQ(entries, actual);
+}
+
+TEST(SwitchTraceTest, IsCompact) {
+    string trace = trace_of(12, 4, {SwitchTraceEntry(100, 11, 3, true), SwitchTraceEntry(180, 11, 3, false)});
+
+    EXPECT_EQ(6u + 2 * 2, trace.size());
+}
+
+TEST(SwitchTraceTest, RejectsOtherFiles) {
+    istringstream in("PK\\x03\\x04 not a trace");
+
+    EXPECT_THROW(SwitchTraceReader reader(in), runtime_error);
+}
+
+TEST(SwitchTraceTest, RejectsTruncatedRecord) {
+    string trace = trace_of(2, 2, {SwitchTraceEntry(1000, 1, 1, true)});
+    istringstream in(trace.substr(0, trace.size() - 1));
+    SwitchTraceReader reader(in);
+    SwitchTraceEntry entry;
+
+    EXPECT_THROW(reader.next(entry), runtime_error);
+}
+
+TEST(SwitchTraceTest, RejectsSwitchOutsideMatrix) {
+    string trace = trace_of(4, 4, {SwitchTraceEntry(1, 3, 3, true)});
+    trace[4] = 2;  // Now only 2 columns.
+    istringstream in(trace);
+    SwitchTraceReader reader(in);
+    SwitchTraceEntry entry;
+
+    EXPECT_THROW(reader.next(entry), runtime_error);
+}
+
+
+constexpr Keymap<1, 2, 2> replay_test_keymap = {{
+    {{
+        {{ KEY_A, KEY_B }},
+        {{ MODIFIERKEY_SHIFT, KEY_C }},
+    }},
+}};
+
+class ReplayTest: public ::testing::Test {
+public:
+    ostringstream reports;
+    Replay<1, 2, 2> replay;
+    ReplayStats stats;
+
+    ReplayTest(): replay(replay_test_keymap, reports) {}
+
+    void when_replayed(vector<SwitchTraceEntry> entries) {
+        istringstream in(trace_of(2, 2, entries));
+        SwitchTraceReader reader(in);
+        stats = replay.run(reader);
+    }
+};
+
+
+TEST_F(ReplayTest, WritesReportsForKeystrokes) {
+    when_replayed({
+        SwitchTraceEntry(1000, 0, 1, true),  // Shift
+        SwitchTraceEntry(1100, 1, 0, true),  // B
+        SwitchTraceEntry(1200, 1, 0, false),
+        SwitchTraceEntry(1300, 0, 1, false),
+    });
+
+    EXPECT_EQ(
+        "1000 e002 00 00 00 00 00 00\n"
+        "1100 e002 05 00 00 00 00 00\n"
+        "1200 e002 00 00 00 00 00 00\n"
+        "1300 0000 00 00 00 00 00 00\n",
+        reports.str());
+    EXPECT_EQ(4u, stats.changes);
+    EXPECT_EQ(4u, stats.events);
+    EXPECT_EQ(4u, stats.reports);
+}
+
+TEST_F(ReplayTest, DebouncesBouncingContacts) {
+    when_replayed({
+        SwitchTraceEntry(1000, 0, 0, true),  // A
+        SwitchTraceEntry(1001, 0, 0, false),
+        SwitchTraceEntry(1002, 0, 0, true),
+        SwitchTraceEntry(1080, 0, 0, false),
+        SwitchTraceEntry(1081, 0, 0, true),
+        SwitchTraceEntry(1082, 0, 0, false),
+    });
+
+    EXPECT_EQ(
+        "1000 0000 04 00 00 00 00 00\n"
+        "1080 0000 00 00 00 00 00 00\n",
+        reports.str());
+    EXPECT_EQ(2u, stats.events);
+}
+
+TEST_F(ReplayTest, SkipsOverPauses) {
+    when_replayed({
+        SwitchTraceEntry(1000, 1, 1, true),
+        SwitchTraceEntry(1100, 1, 1, false),
+        SwitchTraceEntry(3601000, 1, 1, true),
+        SwitchTraceEntry(3601100, 1, 1, false),
+    });
+
+    EXPECT_EQ(4u, stats.reports);
+    EXPECT_EQ("3601100 0000 00 00 00 00 00 00\n", reports.str().substr(reports.str().rfind('\n', reports.str().size() - 2) + 1));
+    EXPECT_LT(stats.scans, 1000u);
+    EXPECT_GT(stats.simulated_millis, 3600000u);
+}
+
+TEST_F(ReplayTest, CountsOnlyLoopsThatScanned) {
+    replay.set_scan_rate(ScanRate(4, 4));
+
+    when_replayed({
+        SwitchTraceEntry(1000, 1, 1, true),
+        SwitchTraceEntry(1100, 1, 1, false),
+    });
+
+    // Stepped through the 51 milliseconds to settle after the press, scanning at every 4th,
+    // then scanned once to see the release and went idle.
+    EXPECT_EQ(14u, stats.scans);
+    EXPECT_EQ(2u, stats.events);
+}
+
+TEST_F(ReplayTest, DoesNotCountReadsOfRowsWhileIdleAsScans) {
+    when_replayed({
+        SwitchTraceEntry(1000, 1, 1, true),
+        SwitchTraceEntry(1100, 1, 1, false),
+    });
+
+    // Scanned each millisecond from 1000 to 1050, and at 1100 to see the release.
+    // From then until settled at 1150 the matrix was idle.
+    EXPECT_EQ(52u, stats.scans);
+    EXPECT_EQ(150u, stats.simulated_millis);
+}
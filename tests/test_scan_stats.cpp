@@ -0,0 +1,78 @@
+/* Tests for scan_stats. */
+
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "scan_stats.h"
+
+
+TEST(ScanHistogramTest, BucketsByPowersOf2) {
+    EXPECT_EQ(0, ScanHistogram::bucket_for(0));
+    EXPECT_EQ(1, ScanHistogram::bucket_for(1));
+    EXPECT_EQ(2, ScanHistogram::bucket_for(2));
+    EXPECT_EQ(2, ScanHistogram::bucket_for(3));
+    EXPECT_EQ(3, ScanHistogram::bucket_for(4));
+    EXPECT_EQ(11, ScanHistogram::bucket_for(1500));
+
+    for (int bucket = 0; bucket < ScanHistogram::bucket_count; ++bucket) {
+        EXPECT_EQ(bucket, ScanHistogram::bucket_for(ScanHistogram::lower_bound(bucket)));
+    }
+}
+
+TEST(ScanHistogramTest, CountsLongDurationsInLastBucket) {
+    ScanHistogram histogram;
+
+    histogram.add(0xFFFFFFFF);
+    histogram.add(1 << 23);
+
+    EXPECT_EQ(2u, histogram.counts[ScanHistogram::bucket_count - 1]);
+}
+
+
+/**
+ * Clock that tests set by hand.
+ */
+struct ManualScanClock {
+    static scan_ticks_t &value() {
+        static scan_ticks_t ticks;
+        return ticks;
+    }
+
+    static scan_ticks_t ticks() {
+        return value();
+    }
+};
+
+TEST(ScanInstrumentationTest, AddsPhaseTimesOverScan) {
+    ScanInstrumentation<ManualScanClock> instrumentation;
+    ManualScanClock::value() = 0xFFFFFFF0;  // About to wrap round.
+
+    ScanInstrumentation<ManualScanClock>::mark_t mark = instrumentation.begin_scan();
+    ManualScanClock::value() += 10;
+    mark = instrumentation.end_phase(SCAN_PHASE_READ, mark);
+    ManualScanClock::value() += 20;
+    mark = instrumentation.end_phase(SCAN_PHASE_DEBOUNCE, mark);
+    ManualScanClock::value() += 30;
+    mark = instrumentation.end_phase(SCAN_PHASE_READ, mark);
+    instrumentation.column_updated<uint8_t>(0x07, 0x01);
+    instrumentation.end_scan(3);
+
+    ScanStats stats = instrumentation.snapshot();
+    EXPECT_EQ(1u, stats.scans);
+    EXPECT_EQ(1u, stats.edges);
+    EXPECT_EQ(2u, stats.held_back_readings);
+    EXPECT_EQ(1u, stats.scan_ticks.counts[ScanHistogram::bucket_for(60)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_READ].counts[ScanHistogram::bucket_for(40)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_DEBOUNCE].counts[ScanHistogram::bucket_for(20)]);
+    EXPECT_EQ(1u, stats.phase_ticks[SCAN_PHASE_STROBE].counts[0]);
+    EXPECT_EQ(1u, stats.held_scans[3]);
+    EXPECT_EQ(60u, stats.held_ticks[3]);
+}
+
+TEST(ScanInstrumentationTest, GroupsManyHeldKeysTogether) {
+    ScanInstrumentation<ManualScanClock> instrumentation;
+
+    instrumentation.begin_scan();
+    instrumentation.end_scan(20);
+
+    EXPECT_EQ(1u, instrumentation.snapshot().held_scans[ScanStats::held_group_count - 1]);
+}
@@ -0,0 +1,225 @@
+/* Tests for scheduler. */
+
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "blinking_thing.h"
+#include "fake_matrix.h"
+#include "keyboard_matrix.h"
+#include "scheduler.h"
+#include "timer_wheel.h"
+
+using namespace std;
+
+
+/**
+ * Stands in for a component: records when it ran and takes as long as it is told.
+ */
+struct FakeComponent {
+    string name;
+    vector<string> *log;
+    unsigned long run_micros;
+    vector<millis_t> runs;
+
+    FakeComponent(const string &name_0, vector<string> *log_0, unsigned long run_micros_0 = 10):
+        name(name_0), log(log_0), run_micros(run_micros_0) {}
+
+    void loop(millis_t millis) {
+        log->push_back(name);
+        runs.push_back(millis);
+        FakeClockTraits::advance_micros(run_micros);
+    }
+};
+
+
+class SchedulerTest: public ::testing::Test {
+public:
+    Scheduler<4, FakeClockTraits> scheduler;
+    vector<string> log;
+    FakeComponent matrix;
+    FakeComponent cortex;
+    FakeComponent blinker;
+
+    SchedulerTest(): matrix("matrix", &log, 100), cortex("cortex", &log, 20), blinker("blinker", &log, 5) {
+        FakeClockTraits::now_micros() = 0;
+    }
+
+    void when_loop_each_milli(millis_t from, millis_t to) {
+        for (millis_t millis = from; millis != to; ++millis) {
+            scheduler.loop(millis);
+        }
+    }
+};
+
+
+TEST_F(SchedulerTest, RunsTaskOnceEveryPeriod) {
+    scheduler.add_loop(blinker, 10, 0);
+
+    when_loop_each_milli(100, 131);
+
+    EXPECT_EQ((vector<millis_t> {100, 110, 120, 130}), blinker.runs);
+}
+
+TEST_F(SchedulerTest, RunsTaskWithPeriod0EveryTimeRound) {
+    scheduler.add_loop(matrix, 0, 0);
+
+    scheduler.loop(5);
+    scheduler.loop(5);
+    scheduler.loop(6);
+
+    EXPECT_EQ((vector<millis_t> {5, 5, 6}), matrix.runs);
+}
+
+TEST_F(SchedulerTest, RunsDueTasksHighestPriorityFirst) {
+    scheduler.add_loop(blinker, 500, 1);
+    scheduler.add_loop(cortex, 1, 2);
+    scheduler.add_loop(matrix, 1, 3);
+
+    scheduler.loop(0);
+    scheduler.loop(1);
+
+    EXPECT_EQ((vector<string> {"matrix", "cortex", "blinker", "matrix", "cortex"}), log);
+}
+
+TEST_F(SchedulerTest, KeepsOrderAddedForEqualPriorities) {
+    scheduler.add_loop(cortex, 1, 1);
+    scheduler.add_loop(blinker, 1, 1);
+    scheduler.add_loop(matrix, 1, 2);
+
+    scheduler.loop(0);
+
+    EXPECT_EQ((vector<string> {"matrix", "cortex", "blinker"}), log);
+}
+
+TEST_F(SchedulerTest, DoesNotStarveLowPriorityTasks) {
+    // Matrix wants to run all the time; blinker still gets its turn.
+    scheduler.add_loop(matrix, 0, 3);
+    scheduler.add_loop(blinker, 100, 0);
+
+    when_loop_each_milli(0, 1000);
+
+    EXPECT_EQ(1000u, matrix.runs.size());
+    EXPECT_EQ(10u, blinker.runs.size());
+}
+
+TEST_F(SchedulerTest, SkipsRunsMissedWhenLate) {
+    scheduler.add_loop(blinker, 10, 0);
+
+    scheduler.loop(0);
+    scheduler.loop(35);
+    scheduler.loop(44);
+    scheduler.loop(45);
+
+    EXPECT_EQ((vector<millis_t> {0, 35, 45}), blinker.runs);
+}
+
+TEST_F(SchedulerTest, KeepsTimeWhenMillisWrapsAround) {
+    millis_t before_wrap = millis_t(0) - 25;
+    scheduler.add_loop(blinker, 10, 0);
+
+    when_loop_each_milli(before_wrap, before_wrap + 31);
+
+    EXPECT_EQ((vector<millis_t> {before_wrap, before_wrap + 10, before_wrap + 20, before_wrap + 30}), blinker.runs);
+}
+
+TEST_F(SchedulerTest, RecordsWorstTimeAndOverruns) {
+    int matrix_task = scheduler.add_loop(matrix, 1, 1, 150);
+    int blinker_task = scheduler.add_loop(blinker, 1, 0);
+
+    scheduler.loop(0);
+    matrix.run_micros = 200;
+    scheduler.loop(1);
+    matrix.run_micros = 120;
+    scheduler.loop(2);
+
+    const TaskStats &stats = scheduler.stats(matrix_task);
+    EXPECT_EQ(3u, stats.run_count);
+    EXPECT_EQ(200u, stats.worst_micros);
+    EXPECT_EQ(1u, stats.overrun_count);
+    EXPECT_EQ(5u, scheduler.stats(blinker_task).worst_micros);
+    EXPECT_EQ(0u, scheduler.stats(blinker_task).overrun_count);
+
+    scheduler.reset_stats();
+    EXPECT_EQ(0u, scheduler.stats(matrix_task).run_count);
+    EXPECT_EQ(0u, scheduler.stats(matrix_task).worst_micros);
+}
+
+TEST_F(SchedulerTest, TimesRunsAcrossMicrosWrappingAround) {
+    FakeClockTraits::now_micros() = 0UL - 30;
+    int task = scheduler.add_loop(matrix, 1, 0);
+
+    scheduler.loop(0);
+
+    EXPECT_EQ(100u, scheduler.stats(task).worst_micros);
+}
+
+TEST_F(SchedulerTest, RefusesTaskWhenFull) {
+    for (int k = 0; k < 4; ++k) {
+        EXPECT_EQ(k, scheduler.add_loop(blinker, 1, 0));
+    }
+
+    EXPECT_EQ(-1, scheduler.add_loop(blinker, 1, 0));
+    EXPECT_EQ(4, scheduler.size());
+}
+
+void count_run(void *context, millis_t) {
+    ++*static_cast<int *>(context);
+}
+
+TEST_F(SchedulerTest, RunsPlainFunctionWithContext) {
+    int run_count = 0;
+    scheduler.add_task(&count_run, &run_count, 2, 0);
+
+    when_loop_each_milli(0, 10);
+
+    EXPECT_EQ(5, run_count);
+}
+
+
+TEST_F(SchedulerTest, RunsRealMatrixEveryTimeRoundSoItScansWhenDue) {
+    FakeMatrixPinTraits::reset();
+    KeyboardMatrix<2, 2, int, FakeMatrixPinTraits> keyboard_matrix(
+        FakeMatrixPinTraits::column_pins<2>(), FakeMatrixPinTraits::row_pins<2>());
+    keyboard_matrix.set_scan_rate(ScanRate(2, 8, 100));
+    // The matrix keeps its own rate, so it is run with period 0.
+    scheduler.add_loop(keyboard_matrix, 0, 3);
+    scheduler.add_loop(cortex, 1, 1);
+    FakeMatrixPinTraits::matrix().set_closed(1, 0, true);
+
+    vector<millis_t> scans;
+    for (millis_t millis = 100; millis < 110; ++millis) {
+        millis_t due = keyboard_matrix.next_scan_millis();
+        scheduler.loop(millis);
+        if (keyboard_matrix.next_scan_millis() != due) {
+            scans.push_back(millis);
+        }
+    }
+
+    EXPECT_EQ((vector<millis_t> {100, 102, 104, 106, 108}), scans);
+    EXPECT_EQ(10u, cortex.runs.size());
+    Switches switches = keyboard_matrix.pressed_switches();
+    ASSERT_EQ(1u, switches.size());
+    EXPECT_EQ(Switch(1, 0), switches[0]);
+}
+
+TEST_F(SchedulerTest, BlinksThroughDispatcherOfSharedWheel) {
+    FakePin pin;
+    TimerWheel<4> wheel;
+    BlinkingThing<FakePin *, FakePinTraits> blinking_thing(wheel, 0, &pin, 5, 10);
+    TimerDispatcher<TimerWheel<4>, 1> timers(wheel);
+    timers.attach(0, blinking_thing);
+    scheduler.add_loop(timers, 1, 0);
+
+    vector<millis_t> changes;
+    int value = pin.get_value();
+    for (millis_t millis = 0; millis < 31; ++millis) {
+        scheduler.loop(millis);
+        if (pin.get_value() != value) {
+            value = pin.get_value();
+            changes.push_back(millis);
+        }
+    }
+
+    EXPECT_EQ((vector<millis_t> {5, 15, 20, 30}), changes);
+}
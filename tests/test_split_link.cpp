@@ -0,0 +1,316 @@
+/* Tests for split_link. */
+
+#include <cstdint>
+#include <vector>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "keyboard_cortex.h"
+#include "loopback_link.h"
+#include "split_link.h"
+
+using namespace std;
+
+
+/**
+ * Test fixture for two halves of 3 columns of 4 rows joined by a loopback link.
+ * The secondary half's columns are numbered 3 to 5 on the primary.
+ */
+class SplitLinkTest: public ::testing::Test {
+public:
+    static const int column_count = 3;
+    static const int row_count = 4;
+
+    SwitchEvents secondary_events;  // As the secondary's matrix would publish them.
+    SplitSender<column_count, row_count> sender;
+    SplitReceiver<column_count, row_count> receiver;
+    LoopbackLink link;
+    millis_t millis;
+
+    SplitLinkTest(): sender(), receiver(column_count), link(), millis(0) {}
+
+    void given_started() {
+        step(0);
+        received();
+    }
+
+    void given_loops_until(millis_t end) {
+        while (static_cast<long>(end - millis) > 0) {
+            step(millis + 1);
+        }
+    }
+
+    void when_changed(int col, int row, bool is_press) {
+        secondary_events.push(SwitchEvent(col, row, is_press, millis));
+    }
+
+    void step(millis_t next_millis) {
+        millis = next_millis;
+        link.set_millis(millis);
+        sender.loop(secondary_events, millis, link);
+        receiver.loop(millis, link);
+    }
+
+    vector<SwitchEvent> received() {
+        vector<SwitchEvent> result;
+        SwitchEvent event;
+        while (receiver.events().pop(event)) {
+            result.push_back(event);
+        }
+        return result;
+    }
+
+    void then_receiver_agrees_with(vector<uint8_t> rows) {
+        for (int col = 0; col < column_count; ++col) {
+            EXPECT_EQ(receiver.pressed_rows_in_column(col), rows[col]) << "Column " << col;
+        }
+    }
+};
+
+
+TEST_F(SplitLinkTest, SendsFullStateOnFirstLoop) {
+    step(0);
+
+    EXPECT_EQ(link.byte_count(), 5u);  // Header, sequence, 2 bytes for 12 switches, check.
+    EXPECT_TRUE(receiver.connected());
+    EXPECT_TRUE(received().empty());
+}
+
+TEST_F(SplitLinkTest, SendsThreeBytesForEachChange) {
+    given_started();
+    unsigned long before = link.byte_count();
+
+    when_changed(2, 1, true);
+    step(1);
+    EXPECT_EQ(link.byte_count() - before, 3u);
+    EXPECT_EQ(received(), vector<SwitchEvent>({SwitchEvent(5, 1, true, 1)}));
+
+    when_changed(2, 1, false);
+    step(2);
+    EXPECT_EQ(link.byte_count() - before, 6u);
+    EXPECT_EQ(received(), vector<SwitchEvent>({SwitchEvent(5, 1, false, 2)}));
+}
+
+TEST_F(SplitLinkTest, PacksChangesFromOneLoopIntoOneFrame) {
+    given_started();
+    unsigned long before = link.byte_count();
+
+    when_changed(0, 0, true);
+    when_changed(1, 2, true);
+    when_changed(2, 3, true);
+    step(1);
+
+    EXPECT_EQ(link.byte_count() - before, 5u);
+    EXPECT_EQ(received(), vector<SwitchEvent>({
+        SwitchEvent(3, 0, true, 1), SwitchEvent(4, 2, true, 1), SwitchEvent(5, 3, true, 1)}));
+    then_receiver_agrees_with({0x1, 0x4, 0x8});
+}
+
+TEST_F(SplitLinkTest, ResendsFullStateEachResyncPeriod) {
+    given_started();
+    when_changed(1, 1, true);
+    given_loops_until(split_resync_millis - 1);
+    unsigned long before = link.byte_count();
+
+    step(split_resync_millis);
+
+    EXPECT_EQ(link.byte_count() - before, 5u);
+    EXPECT_EQ(received(), vector<SwitchEvent>({SwitchEvent(4, 1, true, 1)}));
+    EXPECT_EQ(receiver.stats().corrections, 0u);
+}
+
+TEST_F(SplitLinkTest, DeliversAfterDelay) {
+    link.set_delay(5);
+    step(0);
+    given_loops_until(10);
+
+    when_changed(0, 2, true);
+    given_loops_until(15);  // Sent at 11.
+    EXPECT_TRUE(received().empty());
+
+    step(16);
+    EXPECT_EQ(received(), vector<SwitchEvent>({SwitchEvent(3, 2, true, 16)}));
+}
+
+TEST_F(SplitLinkTest, RepairsLostChangeAtNextResync) {
+    given_started();
+
+    when_changed(0, 3, true);
+    link.drop_next_writes(1);
+    step(1);
+    EXPECT_TRUE(received().empty());
+
+    given_loops_until(split_resync_millis);
+    EXPECT_EQ(received(), vector<SwitchEvent>({SwitchEvent(3, 3, true, split_resync_millis)}));
+    EXPECT_EQ(receiver.stats().lost_frames, 1u);
+    EXPECT_EQ(receiver.stats().corrections, 1u);
+}
+
+TEST_F(SplitLinkTest, AppliesLaterChangesAfterLoss) {
+    given_started();
+
+    when_changed(0, 0, true);
+    link.drop_next_writes(1);
+    step(1);
+    when_changed(1, 0, true);
+    step(2);
+
+    EXPECT_EQ(received(), vector<SwitchEvent>({SwitchEvent(4, 0, true, 2)}));
+    EXPECT_EQ(receiver.stats().lost_frames, 1u);
+}
+
+TEST_F(SplitLinkTest, CountsFramesLostForWholeTurnOfHeaderSequenceAtNextResync) {
+    given_started();
+
+    link.drop_next_writes(16);
+    for (int i = 0; i < 16; ++i) {
+        when_changed(0, 0, i % 2 == 0);
+        step(millis + 1);
+    }
+    when_changed(1, 0, true);
+    step(millis + 1);
+    EXPECT_EQ(received(), vector<SwitchEvent>({SwitchEvent(4, 0, true, 17)}));
+    EXPECT_EQ(receiver.stats().lost_frames, 0u);  // Its 4 bits are those expected.
+
+    given_loops_until(split_resync_millis);
+    EXPECT_EQ(receiver.stats().lost_frames, 16u);
+    EXPECT_EQ(receiver.stats().corrections, 0u);
+}
+
+TEST_F(SplitLinkTest, RecoversFromLostBytes) {
+    given_started();
+    link.set_byte_loss(0.2);
+    for (int i = 0; i < 200; ++i) {
+        when_changed(i % column_count, i % row_count, (i / 5) % 2 == 0);
+        step(millis + 1);
+    }
+    link.set_byte_loss(0);
+    given_loops_until(millis + split_resync_millis);
+
+    for (int col = 0; col < column_count; ++col) {
+        for (int row = 0; row < row_count; ++row) {
+            // Replay the same changes to see what the secondary ended with.
+            bool is_pressed = false;
+            for (int i = 0; i < 200; ++i) {
+                if (i % column_count == col && i % row_count == row) {
+                    is_pressed = (i / 5) % 2 == 0;
+                }
+            }
+            EXPECT_EQ((receiver.pressed_rows_in_column(col) >> row) & 1, is_pressed) << col << ", " << row;
+        }
+    }
+    EXPECT_GT(receiver.stats().bad_frames + receiver.stats().lost_frames, 0u);
+}
+
+TEST_F(SplitLinkTest, ReleasesEverythingWhenLinkTimesOut) {
+    given_started();
+    when_changed(0, 1, true);
+    when_changed(2, 2, true);
+    step(1);
+    received();
+
+    link.drop_next_writes(1000);
+    given_loops_until(1 + split_timeout_millis);
+    EXPECT_TRUE(received().empty());
+    EXPECT_TRUE(receiver.connected());
+
+    step(2 + split_timeout_millis);
+    EXPECT_EQ(received(), vector<SwitchEvent>({
+        SwitchEvent(3, 1, false, 2 + split_timeout_millis), SwitchEvent(5, 2, false, 2 + split_timeout_millis)}));
+    EXPECT_FALSE(receiver.connected());
+    EXPECT_EQ(receiver.stats().timeouts, 1u);
+}
+
+TEST_F(SplitLinkTest, ReconnectsAtNextResync) {
+    given_started();
+    when_changed(1, 3, true);
+    link.drop_next_writes(1000);
+    given_loops_until(split_timeout_millis + 1);
+    received();
+
+    link.drop_next_writes(0);
+    given_loops_until(split_timeout_millis + split_resync_millis);
+
+    EXPECT_TRUE(receiver.connected());
+    then_receiver_agrees_with({0x0, 0x8, 0x0});
+}
+
+
+TEST(MergedSwitchesTest, KeepsPressOrderAcrossHalves) {
+    MergedSwitches<6, 4> merged;
+
+    merged.apply(SwitchEvent(4, 1, true, 10));
+    merged.apply(SwitchEvent(0, 2, true, 11));
+    merged.apply(SwitchEvent(5, 0, true, 12));
+    merged.apply(SwitchEvent(4, 1, false, 13));
+
+    Switches switches = merged.pressed_switches();
+    ASSERT_EQ(switches.size(), 2u);
+    EXPECT_EQ(switches[0], Switch(0, 2));
+    EXPECT_EQ(switches[0].millis, 11u);
+    EXPECT_EQ(switches[1], Switch(5, 0));
+}
+
+TEST(MergedSwitchesTest, FeedsCortexFromBothHalves) {
+    constexpr KeyboardCortex<1, 6, 4>::Keymap keymap = {{
+        {{
+            {{ KEY_Q, KEY_W, KEY_E, KEY_R, KEY_T, KEY_Y }},
+            {{ KEY_A, KEY_S, KEY_D, KEY_F, KEY_G, KEY_H }},
+            {{ MODIFIERKEY_SHIFT, KEY_X, KEY_C, KEY_V, KEY_B, KEY_N }},
+            {{ KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6 }},
+        }},
+    }};
+    KeyboardCortex<1, 6, 4> cortex(keymap);
+    MergedSwitches<6, 4> merged;
+    SplitReceiver<3, 4> receiver(3);
+    LoopbackLink link;
+    SwitchEvents secondary_events;
+    SplitSender<3, 4> sender;
+
+    merged.apply(SwitchEvent(0, 2, true, 1));  // Shift on this half.
+    secondary_events.push(SwitchEvent(1, 1, true, 1));  // G on the other.
+    sender.loop(secondary_events, 1, link);
+    receiver.loop(1, link);
+    SwitchEvent event;
+    while (receiver.events().pop(event)) {
+        merged.apply(event);
+    }
+
+    keyboard_record record = cortex.record_from_switches(merged.pressed_switches());
+    EXPECT_EQ(record.modifier_flags, MODIFIERKEY_SHIFT);
+    EXPECT_EQ(record.keys[0], KEY_G & 0xFF);
+    EXPECT_EQ(record.keys[1], 0);
+}
+
+
+/**
+ * Just enough of an Arduino Stream: read gives -1 when there is nothing to read.
+ */
+struct FakeStream {
+    vector<uint8_t> bytes;
+    size_t next = 0;
+
+    size_t write(const uint8_t *buffer, size_t count) {
+        bytes.insert(bytes.end(), buffer, buffer + count);
+        return count;
+    }
+
+    int read() {
+        return next < bytes.size() ? bytes[next++] : -1;
+    }
+};
+
+TEST(StreamLinkTest, WritesAndReadsThroughStream) {
+    FakeStream stream;
+    StreamLink<FakeStream> link(stream);
+    const uint8_t bytes[] = {0x81, 0x05, 0x06};
+
+    link.write(bytes, 3);
+
+    uint8_t byte;
+    EXPECT_TRUE(link.read(byte));
+    EXPECT_EQ(byte, 0x81);
+    EXPECT_TRUE(link.read(byte));
+    EXPECT_TRUE(link.read(byte));
+    EXPECT_EQ(byte, 0x06);
+    EXPECT_FALSE(link.read(byte));
+}
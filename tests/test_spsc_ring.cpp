@@ -0,0 +1,84 @@
+/* Tests for spsc_ring. */
+
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "spsc_ring.h"
+
+using namespace std;
+
+
+class SpscRingTest: public ::testing::Test {
+public:
+    SpscRing<int, 4> ring;
+
+    vector<int> when_all_popped() {
+        vector<int> result;
+        int item;
+        while (ring.pop(item)) {
+            result.push_back(item);
+        }
+        return result;
+    }
+};
+
+
+TEST_F(SpscRingTest, StartsEmpty) {
+    int item;
+
+    EXPECT_TRUE(ring.empty());
+    EXPECT_EQ(ring.size(), 0);
+    EXPECT_FALSE(ring.pop(item));
+}
+
+TEST_F(SpscRingTest, PopsItemsInOrderPushed) {
+    ring.push(13);
+    ring.push(17);
+    ring.push(21);
+
+    EXPECT_EQ(when_all_popped(), vector<int>({13, 17, 21}));
+}
+
+TEST_F(SpscRingTest, DropsAndCountsItemsWhenFull) {
+    for (int i = 0; i < 6; ++i) {
+        EXPECT_EQ(ring.push(i), i < 4);
+    }
+
+    EXPECT_EQ(ring.overflow_count(), 2);
+    EXPECT_EQ(when_all_popped(), vector<int>({0, 1, 2, 3}));
+}
+
+TEST_F(SpscRingTest, WrapsAround) {
+    for (int i = 0; i < 10; ++i) {
+        ring.push(i);
+        ring.push(i + 100);
+        EXPECT_EQ(when_all_popped(), vector<int>({i, i + 100}));
+    }
+    EXPECT_EQ(ring.overflow_count(), 0);
+}
+
+TEST(SpscRingThreadTest, PassesItemsBetweenThreadsWithoutLoss) {
+    const int item_count = 100000;
+    SpscRing<int, 16> ring;
+    vector<int> received;
+
+    thread consumer([&]() {
+        int item;
+        while (received.size() < item_count) {
+            if (ring.pop(item)) {
+                received.push_back(item);
+            }
+        }
+    });
+    for (int i = 0; i < item_count; ++i) {
+        while (!ring.push(i)) {
+            this_thread::yield();
+        }
+    }
+    consumer.join();
+
+    ASSERT_EQ(received.size(), item_count);
+    for (int i = 0; i < item_count; ++i) {
+        ASSERT_EQ(received[i], i);
+    }
+}
@@ -0,0 +1,215 @@
+/* Tests for tap_hold. */
+
+#include <array>
+#include <vector>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "keyboard_cortex.h"
+#include "keymap.h"
+#include "recording_sink.h"
+#include "tap_hold.h"
+
+using namespace std;
+
+
+TEST(DeadlineQueueTest, KeepsItemsInOrderOfDeadline) {
+    DeadlineQueue<int, 4> queue;
+    queue.push(30, 3);
+    queue.push(10, 1);
+    queue.push(20, 2);
+
+    DeadlineQueue<int, 4>::Item item;
+    EXPECT_FALSE(queue.pop_due(9, item));
+    ASSERT_TRUE(queue.pop_due(25, item));
+    EXPECT_EQ(1, item.value);
+    ASSERT_TRUE(queue.pop_due(25, item));
+    EXPECT_EQ(2, item.value);
+    EXPECT_FALSE(queue.pop_due(25, item));
+    EXPECT_EQ(1, queue.size());
+}
+
+TEST(DeadlineQueueTest, RefusesPushWhenFull) {
+    DeadlineQueue<int, 2> queue;
+    EXPECT_TRUE(queue.push(1, 1));
+    EXPECT_TRUE(queue.push(2, 2));
+
+    EXPECT_FALSE(queue.push(3, 3));
+    EXPECT_TRUE(queue.full());
+}
+
+TEST(DeadlineQueueTest, HandlesMillisWrappingAround) {
+    DeadlineQueue<int, 4> queue;
+    millis_t before_wrap = millis_t(0) - 10;
+    queue.push(before_wrap + 20, 2);  // Wraps round to 10.
+    queue.push(before_wrap + 5, 1);
+
+    DeadlineQueue<int, 4>::Item item;
+    EXPECT_FALSE(queue.pop_due(before_wrap, item));
+    ASSERT_TRUE(queue.pop_due(before_wrap + 5, item));
+    EXPECT_EQ(1, item.value);
+    EXPECT_FALSE(queue.pop_due(before_wrap + 19, item));
+    ASSERT_TRUE(queue.pop_due(before_wrap + 20, item));
+    EXPECT_EQ(2, item.value);
+}
+
+
+// Switch (0, 2) is shift when held and Z when tapped.
+constexpr array<TapHoldKey, 1> tap_hold_keys = {{
+    {0, 2, 200, MODIFIERKEY_SHIFT, KEY_Z},
+}};
+
+
+class TapHoldResolverTest: public ::testing::Test {
+public:
+    TapHoldResolver<> resolver;
+    RecordingSink sink;
+
+    TapHoldResolverTest(): resolver(tap_hold_keys) {}
+
+    void when_event(int col, int row, bool is_press, millis_t millis) {
+        resolver.apply(SwitchEvent(col, row, is_press, millis), sink);
+    }
+
+    void when_loop(millis_t millis) {
+        resolver.loop(millis, sink);
+    }
+
+    void then_forwarded(vector<ForwardedEvent> expected) {
+        EXPECT_EQ(expected, sink.forwarded);
+        sink.forwarded.clear();
+    }
+};
+
+
+TEST_F(TapHoldResolverTest, PassesOtherKeysOnImmediately) {
+    when_event(1, 1, true, 10);
+    then_forwarded({passed(1, 1, true, 10)});
+
+    when_event(1, 1, false, 20);
+    then_forwarded({passed(1, 1, false, 20)});
+}
+
+TEST_F(TapHoldResolverTest, PassesOtherKeysOnImmediatelyWhileDualRoleKeyPending) {
+    when_event(1, 1, true, 10);
+    when_event(0, 2, true, 20);
+    then_forwarded({passed(1, 1, true, 10)});
+
+    // Releasing a key pressed earlier does not decide anything.
+    when_event(1, 1, false, 30);
+    then_forwarded({passed(1, 1, false, 30)});
+    EXPECT_TRUE(resolver.is_pending());
+
+    // Pressing one decides the pending key but is passed on in the same call.
+    when_event(2, 1, true, 40);
+    then_forwarded({pressed_as(0, 2, 20, MODIFIERKEY_SHIFT), passed(2, 1, true, 40)});
+}
+
+TEST_F(TapHoldResolverTest, HoldsBackDualRoleKey) {
+    when_event(0, 2, true, 10);
+    when_loop(10);
+    when_loop(209);
+
+    then_forwarded({});
+    EXPECT_TRUE(resolver.is_pending());
+}
+
+TEST_F(TapHoldResolverTest, ResolvesHoldOnTimeout) {
+    when_event(0, 2, true, 10);
+    when_loop(210);
+    then_forwarded({pressed_as(0, 2, 210, MODIFIERKEY_SHIFT)});
+    EXPECT_FALSE(resolver.is_pending());
+
+    when_event(0, 2, false, 300);
+    then_forwarded({passed(0, 2, false, 300)});
+}
+
+TEST_F(TapHoldResolverTest, ResolvesTapOnQuickRelease) {
+    when_event(0, 2, true, 10);
+    when_event(0, 2, false, 50);
+    then_forwarded({pressed_as(0, 2, 10, KEY_Z)});
+
+    // The release comes next time round so the tap can be reported.
+    when_loop(50);
+    then_forwarded({});
+    when_loop(51);
+    then_forwarded({passed(0, 2, false, 51)});
+    EXPECT_FALSE(resolver.is_pending());
+}
+
+TEST_F(TapHoldResolverTest, ReleasesTapBeforeRepeatedPress) {
+    when_event(0, 2, true, 10);
+    when_event(0, 2, false, 50);
+    when_event(0, 2, true, 50);
+
+    then_forwarded({pressed_as(0, 2, 10, KEY_Z), passed(0, 2, false, 50)});
+    EXPECT_TRUE(resolver.is_pending());
+}
+
+TEST_F(TapHoldResolverTest, ResolvesHoldWhenAnotherKeyInterrupts) {
+    when_event(0, 2, true, 10);
+    when_event(1, 1, true, 30);
+    when_event(1, 1, false, 40);
+    when_event(0, 2, false, 50);
+    when_loop(300);
+
+    then_forwarded({
+        pressed_as(0, 2, 10, MODIFIERKEY_SHIFT),
+        passed(1, 1, true, 30),
+        passed(1, 1, false, 40),
+        passed(0, 2, false, 50),
+    });
+}
+
+TEST_F(TapHoldResolverTest, HandlesMillisWrappingAround) {
+    millis_t before_wrap = millis_t(0) - 100;
+    when_event(0, 2, true, before_wrap);
+    when_loop(before_wrap + 199);
+    then_forwarded({});
+
+    when_loop(before_wrap + 200);
+    then_forwarded({pressed_as(0, 2, before_wrap + 200, MODIFIERKEY_SHIFT)});
+}
+
+
+constexpr KeyboardCortex<1, 3, 3>::Keymap tap_hold_keymap = {{
+    {{
+        {{ KEY_Q, KEY_W, KEY_E }},
+        {{ KEY_A, KEY_S, KEY_D }},
+        {{ KEY_TAB, KEY_X, KEY_C }},
+    }},
+}};
+
+TEST(TapHoldCortexTest, ReportsTapThenRelease) {
+    KeyboardCortex<1, 3, 3> cortex(tap_hold_keymap);
+    TapHoldResolver<> resolver(tap_hold_keys);
+    keyboard_record record;
+
+    resolver.apply(SwitchEvent(0, 2, true, 10), cortex);
+    resolver.loop(10, cortex);
+    EXPECT_FALSE(cortex.take_record(record));
+
+    resolver.apply(SwitchEvent(0, 2, false, 40), cortex);
+    resolver.loop(40, cortex);
+    ASSERT_TRUE(cortex.take_record(record));
+    EXPECT_EQ(KEY_Z & 0xFF, record.keys[0]);
+
+    resolver.loop(41, cortex);
+    ASSERT_TRUE(cortex.take_record(record));
+    EXPECT_EQ(keyboard_record(), record);
+}
+
+TEST(TapHoldCortexTest, ReportsHoldAsModifier) {
+    KeyboardCortex<1, 3, 3> cortex(tap_hold_keymap);
+    TapHoldResolver<> resolver(tap_hold_keys);
+    keyboard_record record;
+
+    resolver.apply(SwitchEvent(0, 2, true, 10), cortex);
+    resolver.apply(SwitchEvent(1, 1, true, 20), cortex);
+    ASSERT_TRUE(cortex.take_record(record));
+    EXPECT_EQ(MODIFIERKEY_SHIFT, record.modifier_flags);
+    EXPECT_EQ(KEY_S & 0xFF, record.keys[0]);
+
+    resolver.apply(SwitchEvent(0, 2, false, 30), cortex);
+    ASSERT_TRUE(cortex.take_record(record));
+    EXPECT_EQ(0, record.modifier_flags);
+}
@@ -0,0 +1,196 @@
+/* Tests for timer_wheel. */
+
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include "Arduino.h"
+#include "gtest/gtest.h"
+#include "timer_wheel.h"
+
+using namespace std;
+
+
+class TimerWheelTest: public ::testing::Test {
+public:
+    TimerWheel<8> wheel;
+    vector<pair<uint16_t, millis_t> > fired;  // Tag and the time the wheel had reached.
+
+    void given_wheel_at(millis_t millis) {
+        wheel = TimerWheel<8>(millis);
+    }
+
+    void when_loop(millis_t millis) {
+        wheel.loop(millis, [this](uint16_t tag, millis_t) {
+            fired.push_back(make_pair(tag, wheel.now()));
+        });
+    }
+
+    void when_loop_each_milli(millis_t from, millis_t to) {
+        for (millis_t millis = from; millis != to; ++millis) {
+            when_loop(millis);
+        }
+    }
+
+    void then_fired(vector<pair<uint16_t, millis_t> > expected) {
+        EXPECT_EQ(expected, fired);
+        fired.clear();
+    }
+};
+
+
+TEST_F(TimerWheelTest, FiresNothingBeforeDeadline) {
+    wheel.schedule(10, 1);
+
+    when_loop(9);
+
+    then_fired({});
+    EXPECT_EQ(1, wheel.size());
+}
+
+TEST_F(TimerWheelTest, FiresAtDeadline) {
+    wheel.schedule(10, 1);
+
+    when_loop(10);
+
+    then_fired({{1, 10}});
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST_F(TimerWheelTest, FiresInOrderOfDeadline) {
+    wheel.schedule(300, 3);
+    wheel.schedule(5, 1);
+    wheel.schedule(40, 2);
+    wheel.schedule(5000, 4);  // Beyond what the levels cover.
+
+    when_loop(10000);
+
+    then_fired({{1, 5}, {2, 40}, {3, 300}, {4, 5000}});
+}
+
+TEST_F(TimerWheelTest, FiresEachAtItsTimeWhenLoopedEveryMilli) {
+    const millis_t deadlines[] = {1, 15, 16, 255, 256, 4095, 4096, 9999};
+    for (millis_t deadline : deadlines) {
+        EXPECT_TRUE(wheel.schedule(deadline, deadline));
+    }
+    // More than capacity, so must be refused.
+    EXPECT_FALSE(wheel.schedule(2, 2));
+
+    when_loop_each_milli(0, 10001);
+
+    for (pair<uint16_t, millis_t> tag_millis : fired) {
+        EXPECT_EQ(tag_millis.first, tag_millis.second);
+    }
+    EXPECT_EQ(8u, fired.size());
+}
+
+TEST_F(TimerWheelTest, FiresDeadlineAlreadyPassedOnNextLoop) {
+    when_loop(100);
+    wheel.schedule(90, 1);
+
+    when_loop(100);
+
+    then_fired({{1, 100}});
+}
+
+TEST_F(TimerWheelTest, HandlerCanScheduleAnother) {
+    wheel.schedule(10, 1);
+
+    wheel.loop(100, [this](uint16_t tag, millis_t deadline) {
+        fired.push_back(make_pair(tag, wheel.now()));
+        if (tag < 4) {
+            wheel.schedule(deadline + 20, tag + 1);
+        }
+    });
+
+    then_fired({{1, 10}, {2, 30}, {3, 50}, {4, 70}});
+}
+
+TEST_F(TimerWheelTest, HandlesMillisWrappingAround) {
+    millis_t before_wrap = millis_t(0) - 100;
+    given_wheel_at(before_wrap);
+    wheel.schedule(before_wrap + 50, 1);
+    wheel.schedule(before_wrap + 150, 2);  // Wraps round to 50.
+    wheel.schedule(before_wrap + 1000, 3);
+
+    when_loop_each_milli(before_wrap, before_wrap + 149);
+    then_fired({{1, before_wrap + 50}});
+
+    when_loop(before_wrap + 150);
+    then_fired({{2, 50}});
+
+    when_loop(before_wrap + 2000);
+    then_fired({{3, 900}});
+}
+
+TEST_F(TimerWheelTest, FiresFarApartTimersInOneLoop) {
+    given_wheel_at(1000);
+    wheel.schedule(1003, 1);
+    wheel.schedule(1300, 2);
+    wheel.schedule(6000, 3);
+    wheel.schedule(100000, 4);  // Beyond what the top level covers.
+
+    when_loop(200000);
+
+    then_fired({{1, 1003}, {2, 1300}, {3, 6000}, {4, 100000}});
+}
+
+TEST_F(TimerWheelTest, MatchesSimpleListOfDeadlines) {
+    srand(12345);
+    given_wheel_at(millis_t(0) - 3000);
+    vector<pair<uint16_t, millis_t> > expected;
+    millis_t millis = wheel.now();
+    for (int step = 0; step < 2000; ++step) {
+        if (wheel.size() < wheel.max_size()) {
+            millis_t deadline = millis + rand() % 600;
+            wheel.schedule(deadline, step);
+            expected.push_back(make_pair(step, deadline));
+        }
+        millis += rand() % 20;
+        when_loop(millis);
+
+        for (auto tag_millis : fired) {
+            auto it = expected.begin();
+            while (it != expected.end() && it->first != tag_millis.first) {
+                ++it;
+            }
+            ASSERT_NE(expected.end(), it) << "Tag " << tag_millis.first;
+            EXPECT_EQ(it->second, tag_millis.second) << "Tag " << tag_millis.first;
+            expected.erase(it);
+        }
+        fired.clear();
+        for (auto tag_deadline : expected) {
+            EXPECT_GT(static_cast<long>(tag_deadline.second - millis), 0) << "Tag " << tag_deadline.first << " missed";
+        }
+    }
+}
+
+
+/**
+ * Stands in for a component driven by timers.
+ */
+struct FakeTimed {
+    vector<millis_t> expired;
+
+    void timer_expired(millis_t deadline) {
+        expired.push_back(deadline);
+    }
+};
+
+TEST(TimerDispatcherTest, PassesTimersToComponentsByTag) {
+    TimerWheel<8> wheel;
+    TimerDispatcher<TimerWheel<8>, 2> timers(wheel);
+    FakeTimed first, second;
+    EXPECT_TRUE(timers.attach(0, first));
+    EXPECT_TRUE(timers.attach(1, second));
+    EXPECT_FALSE(timers.attach(2, first));
+    wheel.schedule(10, 1);
+    wheel.schedule(20, 0);
+    wheel.schedule(30, 1);
+    wheel.schedule(40, 7);  // Nothing attached.
+
+    timers.loop(50);
+
+    EXPECT_EQ(first.expired, vector<millis_t>({20}));
+    EXPECT_EQ(second.expired, vector<millis_t>({10, 30}));
+    EXPECT_TRUE(wheel.empty());
+}